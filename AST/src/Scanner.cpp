@@ -1,5 +1,8 @@
 #include "Scanner.hpp"
 
+#include <charconv>
+#include <cstdint>
+
 Scanner::Scanner(const std::string& source, ILogger& logger) : source(source), logger(logger), tokens()
 {
 }
@@ -201,7 +204,24 @@ void Scanner::readNumber()
         }
     }
 
-    addToken(TokenType::NUMBER, std::stod(source.substr(start, current - start)));
+    // parsed in place; integers short enough to be exact doubles skip std::from_chars altogether
+    const char* first = source.data() + start;
+    const char* last = source.data() + current;
+
+    uint64_t integer = 0;
+    const char* digit = first;
+    for (; digit < last && digit - first < MAX_EXACT_DIGITS && isDigit(*digit); digit++)
+    {
+        integer = integer * 10 + static_cast<uint64_t>(*digit - '0');
+    }
+
+    double value = static_cast<double>(integer);
+    if (digit != last && std::from_chars(first, last, value).ec == std::errc::result_out_of_range)
+    {
+        logger.LogError(line, "Number literal out of range."); // still a number token, so parsing carries on
+    }
+
+    addToken(TokenType::NUMBER, value);
 }
 
 char Scanner::peekNext()
@@ -51,6 +51,9 @@ class Scanner
 
     bool isDigit(char c);
 
+    // below 2^53, so every integer with this many digits is exactly a double
+    static constexpr int MAX_EXACT_DIGITS = 15;
+
     void readNumber();
 
     char peekNext();
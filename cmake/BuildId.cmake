@@ -0,0 +1,25 @@
+# Writes ${OUTPUT}, defining LOXPP_BUILD_ID as a digest of the interpreter sources, so that anything keyed on the
+# build (the chunk cache) changes whenever the compiler does. Runs on every build; the header is only rewritten,
+# and its users only recompiled, when the digest changes.
+#
+# Usage: cmake -DSOURCE_DIR=<src> -DOUTPUT=<header> -P BuildId.cmake
+
+file(GLOB SOURCES ${SOURCE_DIR}/*.cpp ${SOURCE_DIR}/*.hpp)
+list(SORT SOURCES)
+
+set(DIGESTS "")
+foreach(SOURCE ${SOURCES})
+    file(SHA256 ${SOURCE} DIGEST)
+    string(APPEND DIGESTS ${DIGEST})
+endforeach()
+
+string(SHA256 BUILD_ID "${DIGESTS}")
+string(SUBSTRING ${BUILD_ID} 0 16 BUILD_ID)
+
+set(CONTENT "#pragma once\n\n#define LOXPP_BUILD_ID \"${BUILD_ID}\"\n")
+if (EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} PREVIOUS)
+endif()
+if (NOT "${PREVIOUS}" STREQUAL "${CONTENT}")
+    file(WRITE ${OUTPUT} "${CONTENT}")
+endif()
@@ -0,0 +1,198 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "serializer.hpp"
+
+// generated by cmake/BuildId.cmake; builds without it fall back to the time cache.cpp was compiled
+#if __has_include("buildId.hpp")
+#include "buildId.hpp"
+#else
+#define LOXPP_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // 64-bit FNV-1a, which names the entry
+    uint64_t hashSource(std::string_view source)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : source)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t mix(uint64_t value)
+    {
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+
+    // A second hash, unrelated to FNV-1a and stored inside the entry with the source length: text that
+    // collides with a script in the file name still has to match both before its chunk is run.
+    uint64_t checkSource(std::string_view source)
+    {
+        uint64_t hash = mix(source.size());
+        size_t i = 0;
+        for (; i + 8 <= source.size(); i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, source.data() + i, sizeof(word));
+            hash = mix(hash ^ word);
+        }
+
+        uint64_t tail = 0;
+        if (i < source.size())
+            std::memcpy(&tail, source.data() + i, source.size() - i);
+        return mix(hash ^ tail);
+    }
+
+    ChunkKey sourceKey(std::string_view source)
+    {
+        return ChunkKey{source.size(), checkSource(source), LOXPP_BUILD_ID};
+    }
+
+    std::string cacheDirectory()
+    {
+        if (const char* directory = std::getenv("LOXPP_CACHE_DIR"); directory && *directory)
+            return directory;
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return std::string(xdg) + "/loxpp";
+        if (const char* home = std::getenv("HOME"); home && *home)
+            return std::string(home) + "/.cache/loxpp";
+        return "";
+    }
+} // namespace
+
+ChunkCache::ChunkCache() : m_directory(cacheDirectory())
+{
+    if (const char* size = std::getenv("LOXPP_CACHE_SIZE"); size && *size)
+        m_maxSize = std::strtoull(size, nullptr, 10);
+}
+
+std::string ChunkCache::entryPath(const VM& vm, std::string_view source) const
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "/%016llx-v%u-O%d-", static_cast<unsigned long long>(hashSource(source)),
+                  static_cast<unsigned>(CHUNK_FILE_VERSION), vm.optimizationLevel());
+
+    // the build identifier is in the name too, so that interpreters built from different sources keep their own
+    // entries instead of replacing each other's
+    std::string build;
+    for (char c : std::string_view(LOXPP_BUILD_ID))
+        build += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+
+    return m_directory + name + build + ".loxc";
+}
+
+bool ChunkCache::run(VM& vm, std::string_view source, InterpretResult& result)
+{
+    if (m_directory.empty())
+    {
+        m_misses++;
+        return false;
+    }
+
+    std::string path = entryPath(vm, source);
+    ChunkFile file(path);
+    if (!file.isOpen())
+    {
+        m_misses++;
+        return false;
+    }
+
+    ChunkKey key;
+    if (!file.readKey(key) || key != sourceKey(source))
+    {
+        std::error_code error;
+        fs::remove(path, error);
+        m_misses++;
+        return false;
+    }
+
+    // a compile error from a chunk file can only mean it failed to load, so the entry is dropped and the
+    // source compiled instead
+    result = vm.interpret(file);
+    if (result == INTERPRET_COMPILE_ERROR)
+    {
+        std::error_code error;
+        fs::remove(path, error);
+        m_misses++;
+        return false;
+    }
+
+    // the modification time doubles as the last use for eviction
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    m_hits++;
+    return true;
+}
+
+void ChunkCache::store(const VM& vm, std::string_view source, const Chunk& chunk)
+{
+    if (m_directory.empty())
+        return;
+
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error || !writeChunkFile(chunk, vm.globalNames(), entryPath(vm, source), sourceKey(source)))
+        return;
+
+    evict();
+}
+
+void ChunkCache::evict()
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type lastUse;
+        uintmax_t size;
+    };
+
+    std::error_code error;
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(m_directory, error))
+    {
+        if (file.path().extension() != ".loxc" || !file.is_regular_file(error))
+            continue;
+
+        Entry entry{file.path(), file.last_write_time(error), file.file_size(error)};
+        if (error)
+            continue;
+
+        total += entry.size;
+        entries.push_back(std::move(entry));
+    }
+
+    if (total <= m_maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+
+    for (const Entry& entry : entries)
+    {
+        if (total <= m_maxSize)
+            break;
+
+        if (fs::remove(entry.path, error))
+        {
+            total -= entry.size;
+            m_evictions++;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "chunk.hpp"
+#include "vm.hpp"
+
+// Directory of compiled chunks keyed by a hash of the source text, the chunk format version, the optimization
+// level and the interpreter build, so that runFile can skip scanning and compiling a script it has seen before.
+// Each entry also records the source's length and a second hash, checked before it runs. The directory is
+// $LOXPP_CACHE_DIR, else $XDG_CACHE_HOME/loxpp, else $HOME/.cache/loxpp; its total size is kept under
+// $LOXPP_CACHE_SIZE bytes (DEFAULT_MAX_SIZE if unset) by evicting the least recently used entries.
+// Every failure is treated as a miss: the cache never stops a script from running.
+class ChunkCache
+{
+  public:
+    static constexpr uintmax_t DEFAULT_MAX_SIZE = 64 * 1024 * 1024;
+
+    ChunkCache();
+
+    // Runs the cached chunk for `source` if there is a usable one and stores the result in `result`; returns
+    // false on a miss, in which case nothing has been executed.
+    bool run(VM& vm, std::string_view source, InterpretResult& result);
+
+    // Writes a freshly compiled chunk for `source`, which must not have been executed yet (quickening rewrites
+    // the code), then evicts old entries until the directory is back under its size cap.
+    void store(const VM& vm, std::string_view source, const Chunk& chunk);
+
+    uint64_t hits() const
+    {
+        return m_hits;
+    }
+
+    uint64_t misses() const
+    {
+        return m_misses;
+    }
+
+    uint64_t evictions() const
+    {
+        return m_evictions;
+    }
+
+  private:
+    std::string m_directory;
+    uintmax_t m_maxSize = DEFAULT_MAX_SIZE;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+
+    std::string entryPath(const VM& vm, std::string_view source) const;
+    void evict();
+};
@@ -0,0 +1,213 @@
+#include "chunk.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+void Chunk::truncate(size_t codeLength, size_t constantCount)
+{
+    code.resize(codeLength);
+    while (!lines.empty() && lines.back().offset >= codeLength)
+    {
+        lines.pop_back();
+    }
+
+    for (size_t i = constantCount; i < constants.size(); i++)
+    {
+        Value constant = constants[i];
+        if (constant.isNumber())
+            numberConstants.erase(std::bit_cast<uint64_t>(constant.asNumber()));
+        else if (constant.isObj())
+            objectConstants.erase(constant.asObj());
+    }
+    constants.resize(constantCount);
+}
+
+void Chunk::dropConstantIndexes()
+{
+    // swapped out rather than cleared, which would keep the bucket arrays
+    std::unordered_map<uint64_t, size_t>().swap(numberConstants);
+    std::unordered_map<Obj*, size_t>().swap(objectConstants);
+}
+
+int Chunk::getLine(size_t offset) const
+{
+    // last run starting at or before the offset
+    auto run = std::upper_bound(lines.begin(), lines.end(), offset,
+                                [](size_t offset, const LineStart& start) { return offset < start.offset; });
+    if (run == lines.begin())
+        return 0;
+
+    return std::prev(run)->line;
+}
+
+size_t instructionLength(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL_SLOT:
+    case OP_DEFINE_GLOBAL_SLOT:
+    case OP_SET_GLOBAL_SLOT:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_CALL:
+        return 2;
+    case OP_GET_LOCAL_LONG:
+    case OP_SET_LOCAL_LONG:
+    case OP_ADD_LOCALS:
+        return 3;
+    case OP_CONSTANT_LONG:
+    case OP_GET_GLOBAL_SLOT_LONG:
+    case OP_DEFINE_GLOBAL_SLOT_LONG:
+    case OP_SET_GLOBAL_SLOT_LONG:
+    case OP_CLOSURE_LONG:
+        return 4;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_LESS:
+        return 5;
+    case OP_LESS_LOCAL_CONST_JUMP:
+        return 7;
+    default:
+        return 1;
+    }
+}
+
+int stackEffect(const uint8_t* code, size_t offset)
+{
+    switch (code[offset])
+    {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG:
+    case OP_GET_GLOBAL_SLOT:
+    case OP_GET_GLOBAL_SLOT_LONG:
+    case OP_GET_UPVALUE:
+    case OP_ADD_LOCALS:
+    case OP_CLOSURE:
+    case OP_CLOSURE_LONG:
+        return 1;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL_SLOT:
+    case OP_DEFINE_GLOBAL_SLOT_LONG:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_PRINT:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_CLOSE_UPVALUE:
+    case OP_RETURN:
+        return -1;
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_LESS:
+        return -2;
+    case OP_CALL:
+        return -code[offset + 1];
+    default:
+        return 0;
+    }
+}
+
+bool isJump(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_LESS_LOCAL_CONST_JUMP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint32_t readJumpOffset(const Chunk& chunk, size_t offset)
+{
+    return readJumpOffset(chunk.code.data(), offset);
+}
+
+uint32_t readJumpOffset(const uint8_t* code, size_t offset)
+{
+    const uint8_t* operand = &code[offset + instructionLength(code[offset]) - 4];
+    return (static_cast<uint32_t>(operand[0]) << 24) | (static_cast<uint32_t>(operand[1]) << 16) |
+           (static_cast<uint32_t>(operand[2]) << 8) | operand[3];
+}
+
+size_t computeMaxStackDepth(const Chunk& chunk, int entryDepth)
+{
+    // depth on entry to each instruction; -1 until a path reaches it
+    std::vector<int> depthAt(chunk.code.size(), -1);
+    std::vector<size_t> worklist = {0};
+    int maxDepth = entryDepth;
+
+    auto reach = [&](size_t offset, int depth) {
+        if (offset < depthAt.size() && depthAt[offset] < depth)
+        {
+            depthAt[offset] = depth;
+            worklist.push_back(offset);
+        }
+    };
+
+    if (!chunk.code.empty())
+        depthAt[0] = entryDepth;
+
+    while (!worklist.empty())
+    {
+        size_t offset = worklist.back();
+        worklist.pop_back();
+
+        uint8_t instruction = chunk.code[offset];
+        int depth = depthAt[offset] + stackEffect(chunk.code.data(), offset);
+        maxDepth = std::max(maxDepth, depth);
+
+        size_t next = offset + instructionLength(instruction);
+        switch (instruction)
+        {
+        case OP_RETURN:
+            break;
+        case OP_JUMP:
+            reach(next + readJumpOffset(chunk, offset), depth);
+            break;
+        default:
+            if (isJump(instruction))
+                reach(next + readJumpOffset(chunk, offset), depth);
+            reach(next, depth);
+            break;
+        }
+    }
+
+    return static_cast<size_t>(maxDepth);
+}
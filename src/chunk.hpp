@@ -1,25 +1,47 @@
 #pragma once
 
+#include <bit>
+#include <unordered_map>
 #include <vector>
 
 #include "value.hpp"
 
+// largest index a _LONG instruction can address with its 24-bit operand
+constexpr size_t MAX_LONG_OPERAND = 0xffffff;
+
+// Operand encodings: plain instructions take one byte; the _LONG constant and global forms take a 24-bit
+// big-endian operand, _LONG locals a 16-bit one, and jumps a 32-bit offset.
 enum OpCode
 {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
     OP_POP,
     OP_GET_LOCAL,
     OP_SET_LOCAL,
-    OP_GET_GLOBAL,
-    OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL,
+    OP_GET_LOCAL_LONG,
+    OP_SET_LOCAL_LONG,
+    OP_GET_GLOBAL_SLOT,
+    OP_DEFINE_GLOBAL_SLOT,
+    OP_SET_GLOBAL_SLOT,
+    OP_GET_GLOBAL_SLOT_LONG,
+    OP_DEFINE_GLOBAL_SLOT_LONG,
+    OP_SET_GLOBAL_SLOT_LONG,
+    // index into the running closure's upvalues
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    OP_NOT_EQUAL,
+    OP_GREATER_EQUAL,
+    OP_LESS_EQUAL,
     OP_ADD,
+    // OP_ADD rewrites itself into one of these once it has seen its operand types (see VM::run)
+    OP_ADD_NUM,
+    OP_ADD_STR,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
@@ -28,24 +50,98 @@ enum OpCode
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_FALSE,
+    // pop two operands and jump when the comparison the compiler saw is false, e.g. `a < b` -> OP_JUMP_IF_NOT_LESS
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_EQUAL,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_LESS,
+    // superinstructions, only produced by the optimizer at -O2 (see optimizer.cpp)
+    OP_ADD_LOCALS,
+    OP_LESS_LOCAL_CONST_JUMP,
+    // wraps the function constant in a closure, capturing the upvalues listed in ObjFunction::upvalues
+    OP_CLOSURE,
+    OP_CLOSURE_LONG,
+    // pops a local that a closure captured, moving it into its upvalue
+    OP_CLOSE_UPVALUE,
+    // argument count; the callee sits below its arguments and the result replaces all of them
+    OP_CALL,
+    // pops the result, discards the frame and pushes the result for the caller
     OP_RETURN,
 };
 
+// Line information is run-length encoded: one entry per run of bytes that came from the same source line.
+struct LineStart
+{
+    size_t offset;
+    int line;
+};
+
 struct Chunk
 {
     std::vector<uint8_t> code;
     std::vector<Value> constants;
-    std::vector<int> lines;
+    std::vector<LineStart> lines;
+    // deepest the value stack can grow while running this chunk, checked once on entry
+    size_t maxStackDepth = 0;
+
+    // dedup indexes for addConstant, only needed while the chunk is being written; see dropConstantIndexes
+    std::unordered_map<uint64_t, size_t> numberConstants;
+    std::unordered_map<Obj*, size_t> objectConstants;
 
     void writeChunk(uint8_t byte, int line)
     {
+        if (lines.empty() || lines.back().line != line)
+        {
+            lines.push_back(LineStart{code.size(), line});
+        }
+
         code.push_back(byte);
-        lines.push_back(line);
     }
 
+    // Drops code past codeLength and constants past constantCount, e.g. when the compiler folds constants.
+    void truncate(size_t codeLength, size_t constantCount);
+
+    // Frees the addConstant indexes once the chunk is finished, so a resident chunk carries only what it runs.
+    void dropConstantIndexes();
+
+    // Source line of the byte at this offset; only consulted for errors and disassembly.
+    int getLine(size_t offset) const;
+
+    // Returns the slot of an equal constant if the pool already has one. Numbers are matched by bit pattern
+    // (so 0 and -0 stay distinct) and strings by their interned pointer.
     size_t addConstant(Value value)
     {
+        if (value.isNumber())
+        {
+            auto [it, inserted] =
+                numberConstants.try_emplace(std::bit_cast<uint64_t>(value.asNumber()), constants.size());
+            if (!inserted)
+                return it->second;
+        }
+        else if (value.isObj())
+        {
+            auto [it, inserted] = objectConstants.try_emplace(value.asObj(), constants.size());
+            if (!inserted)
+                return it->second;
+        }
+
         constants.push_back(value);
         return constants.size() - 1;
     }
 };
+
+// Size in bytes of the instruction starting with this opcode, operands included.
+size_t instructionLength(uint8_t instruction);
+// Net number of values the instruction at this offset leaves on the stack (negative when it pops).
+int stackEffect(const uint8_t* code, size_t offset);
+// Any instruction that carries a jump offset; the offset is always its last four bytes.
+bool isJump(uint8_t instruction);
+// Forward distance encoded by the jump instruction at this offset, measured from the end of the instruction.
+uint32_t readJumpOffset(const Chunk& chunk, size_t offset);
+uint32_t readJumpOffset(const uint8_t* code, size_t offset);
+// Walks every path through the chunk, following jumps, and returns the deepest stack it can reach, counting the
+// entryDepth slots (a function's callee and parameters) already in the frame when it starts.
+size_t computeMaxStackDepth(const Chunk& chunk, int entryDepth = 0);
@@ -1,4 +1,26 @@
 #pragma once
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
\ No newline at end of file
+// Value packed into a double's NaN payload, 8 bytes instead of a tagged union's 16; build with -DNO_NAN_BOXING
+// for the union
+#ifndef NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+// labels-as-values dispatch in VM::run, falling back to a switch on other compilers; build with
+// -DSWITCH_DISPATCH to time the switch loop on GCC/Clang too
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SWITCH_DISPATCH)
+#define COMPUTED_GOTO
+#endif
+
+// SSE2 (AVX2 when the target has it, e.g. -mavx2) fast paths for the scanner's runs of whitespace, comments,
+// identifiers and digits; build with -DSCALAR_SCANNER for the plain loops
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(SCALAR_SCANNER)
+#define SIMD_SCANNER
+#endif
+
+// #define DEBUG_TRACE_EXECUTION
+// #define DEBUG_PRINT_CODE
+
+// collect on every allocation / log each collection
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
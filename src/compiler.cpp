@@ -1,9 +1,14 @@
 #include "compiler.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 
 #include "common.hpp"
+#include "object.hpp"
+#include "optimizer.hpp"
 #include "scanner.hpp"
 #include "vm.hpp"
 
@@ -11,9 +16,11 @@
 #include "debug.hpp"
 #endif
 
-bool Compiler::compile(const std::string& source, Chunk* chunk)
+bool Compiler::compile(std::string_view source, Chunk* chunk)
 {
     m_scanner.setSource(source);
+    FunctionScope script{nullptr, nullptr, TYPE_SCRIPT, chunk, {}, 0};
+    m_function = &script;
     m_currentChunk = chunk;
 
     m_parser.hadError = false;
@@ -28,6 +35,7 @@ bool Compiler::compile(const std::string& source, Chunk* chunk)
     }
 
     endCompiler();
+    m_function = nullptr;
 
     return !m_parser.hadError;
 }
@@ -98,15 +106,27 @@ void Compiler::emitByte(uint8_t byte)
 void Compiler::endCompiler()
 {
     emitReturn();
+    optimizeChunk(*m_currentChunk, m_optimizationLevel);
+    m_currentChunk->dropConstantIndexes();
+
+    ObjFunction* function = m_function->function;
+    int entryDepth = function != nullptr ? function->arity + 1 : 0;
+    m_currentChunk->maxStackDepth = computeMaxStackDepth(*m_currentChunk, entryDepth);
+
+    // VM::run refuses a frame deeper than its stack, so report it here rather than when the code runs
+    if (m_currentChunk->maxStackDepth > VM::STACK_MAX)
+        error("Too many local variables in function.");
 
 #ifdef DEBUG_PRINT_CODE
     if (!m_parser.hadError)
-        disassembleChunk(*m_currentChunk, "code");
+        disassembleChunk(*m_currentChunk, function != nullptr ? function->name->str : "code");
 #endif
 }
 
+// the implicit `return nil;` at the end of every function and of the script
 void Compiler::emitReturn()
 {
+    emitByte(OP_NIL);
     emitByte(OP_RETURN);
 }
 
@@ -121,27 +141,148 @@ void Compiler::expression()
     parsePrecedence(Precedence::PREC_ASSIGNMENT);
 }
 
+// A number token is digits with an optional fraction. Integers of up to MAX_EXACT_DIGITS digits are accumulated
+// directly; anything else goes to std::from_chars, which parses the token in place without allocating or consulting
+// the locale.
 void Compiler::numberConstant(bool)
 {
-    double value = std::stod(std::string(m_parser.previous.start, m_parser.previous.length));
+    const char* start = m_parser.previous.start;
+    const char* end = start + m_parser.previous.length;
+
+    uint64_t integer = 0;
+    const char* digit = start;
+    for (; digit < end && digit - start < MAX_EXACT_DIGITS && *digit >= '0' && *digit <= '9'; digit++)
+    {
+        integer = integer * 10 + static_cast<uint64_t>(*digit - '0');
+    }
+
+    double value = static_cast<double>(integer);
+    if (digit != end && std::from_chars(start, end, value).ec == std::errc::result_out_of_range)
+    {
+        error("Number literal out of range.");
+        return;
+    }
+
     emitConstant(Value(value));
 }
 
 void Compiler::emitConstant(Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    size_t offset = m_currentChunk->code.size();
+    size_t poolSize = m_currentChunk->constants.size();
+
+    emitOperandInstruction(OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(value), 3);
+    m_lastConstant = ConstantLoad{offset, m_currentChunk->code.size(), poolSize, value};
+}
+
+void Compiler::emitLoad(Value value)
+{
+    size_t offset = m_currentChunk->code.size();
+
+    if (value.isNil())
+        emitByte(OP_NIL);
+    else if (value.isBool())
+        emitByte(value.asBool() ? OP_TRUE : OP_FALSE);
+    else
+        return emitConstant(value);
+
+    m_lastConstant = ConstantLoad{offset, m_currentChunk->code.size(), m_currentChunk->constants.size(), value};
+}
+
+bool Compiler::lastConstant(ConstantLoad& load) const
+{
+    if (!m_lastConstant || m_lastConstant->end != m_currentChunk->code.size())
+        return false;
+
+    load = *m_lastConstant;
+    return true;
 }
 
-uint8_t Compiler::makeConstant(Value value)
+// Evaluates a binary operator on two constants at compile time. Operand types the runtime would reject
+// are left unfolded so the error still happens, with its line, when the code runs.
+bool Compiler::foldBinary(TokenType operatorType, Value a, Value b, Value& result)
+{
+    switch (operatorType)
+    {
+    case TOKEN_EQUAL_EQUAL:
+        result = Value(a == b);
+        return true;
+    case TOKEN_BANG_EQUAL:
+        result = Value(!(a == b));
+        return true;
+    case TOKEN_PLUS:
+        if (a.isString() && b.isString())
+        {
+            result = Value(m_vm.takeString(a.asString()->str + b.asString()->str));
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!a.isNumber() || !b.isNumber())
+        return false;
+
+    double x = a.asNumber();
+    double y = b.asNumber();
+    switch (operatorType)
+    {
+    case TOKEN_GREATER:
+        result = Value(x > y);
+        return true;
+    case TOKEN_GREATER_EQUAL:
+        result = Value(!(x < y));
+        return true;
+    case TOKEN_LESS:
+        result = Value(x < y);
+        return true;
+    case TOKEN_LESS_EQUAL:
+        result = Value(!(x > y));
+        return true;
+    case TOKEN_PLUS:
+        result = Value(x + y);
+        return true;
+    case TOKEN_MINUS:
+        result = Value(x - y);
+        return true;
+    case TOKEN_STAR:
+        result = Value(x * y);
+        return true;
+    case TOKEN_SLASH:
+        result = Value(x / y);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Compiler::emitOperandInstruction(uint8_t instruction, uint8_t longInstruction, size_t operand, int longWidth)
+{
+    if (operand <= UINT8_MAX)
+    {
+        emitBytes(instruction, static_cast<uint8_t>(operand));
+        return;
+    }
+
+    // big-endian, matching the jump operands
+    emitByte(longInstruction);
+    for (int shift = (longWidth - 1) * 8; shift >= 0; shift -= 8)
+    {
+        emitByte(static_cast<uint8_t>((operand >> shift) & 0xff));
+    }
+}
+
+size_t Compiler::makeConstant(Value value)
 {
     size_t constant = m_currentChunk->addConstant(value);
-    if (constant > UINT8_MAX)
+    if (constant > MAX_LONG_OPERAND)
     {
         error("Too many constants in one chunk.");
         return 0;
     }
 
-    return static_cast<uint8_t>(constant);
+    return constant;
 }
 void Compiler::grouping(bool)
 {
@@ -155,6 +296,15 @@ void Compiler::unary(bool)
 
     parsePrecedence(Precedence::PREC_UNARY);
 
+    ConstantLoad operand;
+    if (lastConstant(operand) && (operatorType == TOKEN_BANG || operand.value.isNumber()))
+    {
+        Value result = operatorType == TOKEN_BANG ? Value(isFalsey(operand.value)) : Value(-operand.value.asNumber());
+        m_currentChunk->truncate(operand.offset, operand.poolSize);
+        emitLoad(result);
+        return;
+    }
+
     // emite operator instruction
     switch (operatorType)
     {
@@ -169,10 +319,34 @@ void Compiler::unary(bool)
     }
 }
 
+// Tokens not listed have no prefix or infix rule and PREC_NONE.
+constexpr std::array<Compiler::ParseRule, TOKEN_EOF + 1> Compiler::rules = [] {
+    std::array<ParseRule, TOKEN_EOF + 1> table{};
+    table[TOKEN_LEFT_PAREN] = {&Compiler::grouping, &Compiler::call, PREC_CALL};
+    table[TOKEN_MINUS] = {&Compiler::unary, &Compiler::binary, PREC_TERM};
+    table[TOKEN_PLUS] = {nullptr, &Compiler::binary, PREC_TERM};
+    table[TOKEN_SLASH] = {nullptr, &Compiler::binary, PREC_FACTOR};
+    table[TOKEN_STAR] = {nullptr, &Compiler::binary, PREC_FACTOR};
+    table[TOKEN_BANG] = {&Compiler::unary, nullptr, PREC_NONE};
+    table[TOKEN_BANG_EQUAL] = {nullptr, &Compiler::binary, PREC_EQUALITY};
+    table[TOKEN_EQUAL_EQUAL] = {nullptr, &Compiler::binary, PREC_EQUALITY};
+    table[TOKEN_GREATER] = {nullptr, &Compiler::binary, PREC_COMPARISON};
+    table[TOKEN_GREATER_EQUAL] = {nullptr, &Compiler::binary, PREC_COMPARISON};
+    table[TOKEN_LESS] = {nullptr, &Compiler::binary, PREC_COMPARISON};
+    table[TOKEN_LESS_EQUAL] = {nullptr, &Compiler::binary, PREC_COMPARISON};
+    table[TOKEN_IDENTIFIER] = {&Compiler::variable, nullptr, PREC_NONE};
+    table[TOKEN_STRING] = {&Compiler::stringConstant, nullptr, PREC_NONE};
+    table[TOKEN_NUMBER] = {&Compiler::numberConstant, nullptr, PREC_NONE};
+    table[TOKEN_FALSE] = {&Compiler::literal, nullptr, PREC_NONE};
+    table[TOKEN_NIL] = {&Compiler::literal, nullptr, PREC_NONE};
+    table[TOKEN_TRUE] = {&Compiler::literal, nullptr, PREC_NONE};
+    return table;
+}();
+
 void Compiler::parsePrecedence(Precedence precedence)
 {
     advance();
-    ParseFn prefixRule = rules.at(m_parser.previous.type).prefix;
+    ParseFn prefixRule = rules[m_parser.previous.type].prefix;
     if (prefixRule == nullptr)
     {
         error("Expect expression.");
@@ -180,13 +354,13 @@ void Compiler::parsePrecedence(Precedence precedence)
     }
 
     bool canAssign = precedence <= Precedence::PREC_ASSIGNMENT;
-    prefixRule(this, canAssign); // Call the prefix parse function
+    (this->*prefixRule)(canAssign); // Call the prefix parse function
 
-    while (precedence <= rules.at(m_parser.current.type).precedence)
+    while (precedence <= rules[m_parser.current.type].precedence)
     {
         advance();
-        ParseFn infixRule = rules.at(m_parser.previous.type).infix;
-        infixRule(this, canAssign); // Call the infix parse function
+        ParseFn infixRule = rules[m_parser.previous.type].infix;
+        (this->*infixRule)(canAssign); // Call the infix parse function
     }
 
     if (canAssign && match(TOKEN_EQUAL))
@@ -198,9 +372,26 @@ void Compiler::parsePrecedence(Precedence precedence)
 void Compiler::binary(bool)
 {
     TokenType operatorType = m_parser.previous.type;
-    const ParseRule& rule = rules.at(operatorType);
+    const ParseRule& rule = rules[operatorType];
+
+    ConstantLoad left;
+    bool leftIsConstant = lastConstant(left);
+
     parsePrecedence(static_cast<Precedence>(rule.precedence + 1));
 
+    ConstantLoad right;
+    Value result;
+    if (leftIsConstant && lastConstant(right) && right.offset == left.end &&
+        foldBinary(operatorType, left.value, right.value, result))
+    {
+        // the result is interned and rooted through the constants until truncate, and emitting it
+        // allocates nothing
+        m_currentChunk->truncate(left.offset, left.poolSize);
+        emitLoad(result);
+        return;
+    }
+
+    size_t offset = m_currentChunk->code.size();
     switch (operatorType)
     {
     case TOKEN_BANG_EQUAL:
@@ -236,6 +427,11 @@ void Compiler::binary(bool)
     default:
         return; // Unreachable.
     }
+
+    if (rule.precedence == PREC_EQUALITY || rule.precedence == PREC_COMPARISON)
+    {
+        m_lastComparison = Comparison{offset, m_currentChunk->code.size(), operatorType};
+    }
 }
 
 void Compiler::literal(bool)
@@ -243,13 +439,13 @@ void Compiler::literal(bool)
     switch (m_parser.previous.type)
     {
     case TOKEN_FALSE:
-        emitByte(OP_FALSE);
+        emitLoad(Value(false));
         break;
     case TOKEN_TRUE:
-        emitByte(OP_TRUE);
+        emitLoad(Value(true));
         break;
     case TOKEN_NIL:
-        emitByte(OP_NIL);
+        emitLoad(Value(nullptr));
         break;
     default:
         return; // Unreachable.
@@ -258,8 +454,7 @@ void Compiler::literal(bool)
 
 void Compiler::stringConstant(bool)
 {
-    auto obj = std::make_shared<ObjString>(m_parser.previous.start + 1, m_parser.previous.length - 2);
-    m_vm.insertObject(obj);
+    ObjString* obj = m_vm.copyString(m_parser.previous.start + 1, m_parser.previous.length - 2);
     emitConstant(Value(obj));
 }
 
@@ -278,7 +473,11 @@ bool Compiler::check(TokenType type)
 
 void Compiler::declaration()
 {
-    if (match(TOKEN_VAR))
+    if (match(TOKEN_FUN))
+    {
+        funDeclaration();
+    }
+    else if (match(TOKEN_VAR))
     {
         varDeclaration();
     }
@@ -303,6 +502,10 @@ void Compiler::statement()
     {
         ifStatement();
     }
+    else if (match(TOKEN_RETURN))
+    {
+        returnStatement();
+    }
     else if (match(TOKEN_LEFT_BRACE))
     {
         beginScope();
@@ -322,6 +525,24 @@ void Compiler::printStatement()
     emitByte(OP_PRINT);
 }
 
+void Compiler::returnStatement()
+{
+    if (m_function->type == TYPE_SCRIPT)
+    {
+        error("Can't return from top-level code.");
+    }
+
+    if (match(TOKEN_SEMICOLON))
+    {
+        emitReturn();
+        return;
+    }
+
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+    emitByte(OP_RETURN);
+}
+
 void Compiler::expressionStatement()
 {
     expression();
@@ -358,9 +579,67 @@ void Compiler::synchronize()
     }
 }
 
+void Compiler::funDeclaration()
+{
+    size_t global = parseVariable("Expect function name.");
+    // initialized before the body is compiled so the function can call itself
+    markInitialized();
+    function(TYPE_FUNCTION);
+    defineVariable(global);
+}
+
+void Compiler::function(FunctionType type)
+{
+    // the name and then the function are kept on the VM stack until the function is in the enclosing chunk's
+    // constants, since nothing else roots them while the body compiles
+    Token nameToken = m_parser.previous;
+    ObjString* name = m_vm.copyString(nameToken.start, nameToken.length);
+    m_vm.push(Value(name));
+    ObjFunction* function = m_vm.allocateObject<ObjFunction>(name);
+    m_vm.pop();
+    m_vm.push(Value(function));
+
+    FunctionScope scope{m_function, function, type, &function->chunk, {}, 0};
+    scope.locals.push_back(Local{Token(TOKEN_IDENTIFIER, "", 0, nameToken.line), 0});
+    m_function = &scope;
+    m_currentChunk = scope.chunk;
+    // the folding state refers to offsets in the enclosing chunk
+    m_lastConstant.reset();
+    m_lastComparison.reset();
+
+    beginScope();
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            function->arity++;
+            if (function->arity > UINT8_MAX)
+            {
+                errorAtCurrent("Can't have more than 255 parameters.");
+            }
+
+            size_t constant = parseVariable("Expect parameter name.");
+            defineVariable(constant);
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
+
+    endCompiler();
+    m_function = scope.enclosing;
+    m_currentChunk = m_function->chunk;
+    m_lastConstant.reset();
+    m_lastComparison.reset();
+
+    emitOperandInstruction(OP_CLOSURE, OP_CLOSURE_LONG, makeConstant(Value(function)), 3);
+    m_vm.pop();
+}
+
 void Compiler::varDeclaration()
 {
-    uint8_t global = parseVariable("Expect variable name.");
+    size_t global = parseVariable("Expect variable name.");
 
     if (match(TOKEN_EQUAL))
     {
@@ -376,31 +655,38 @@ void Compiler::varDeclaration()
     defineVariable(global);
 }
 
-uint8_t Compiler::parseVariable(const char* errorMessage)
+size_t Compiler::parseVariable(const char* errorMessage)
 {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();
-    if (m_scopeDepth > 0)
+    if (m_function->scopeDepth > 0)
         return 0;
 
-    return identifierConstant(m_parser.previous);
+    return globalSlot(m_parser.previous);
 }
 
-uint8_t Compiler::identifierConstant(const Token& name)
+size_t Compiler::globalSlot(const Token& name)
 {
-    return makeConstant(Value(std::make_shared<ObjString>(name.start, name.length)));
+    size_t slot = m_vm.globalSlot(m_vm.copyString(name.start, name.length));
+    if (slot > MAX_LONG_OPERAND)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
 }
 
-void Compiler::defineVariable(uint8_t global)
+void Compiler::defineVariable(size_t global)
 {
-    if (m_scopeDepth > 0)
+    if (m_function->scopeDepth > 0)
     {
         markInitialized();
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitOperandInstruction(OP_DEFINE_GLOBAL_SLOT, OP_DEFINE_GLOBAL_SLOT_LONG, global, 3);
 }
 
 void Compiler::variable(bool canAssign)
@@ -408,36 +694,83 @@ void Compiler::variable(bool canAssign)
     namedVariable(m_parser.previous, canAssign);
 }
 
+void Compiler::call(bool)
+{
+    uint8_t argCount = argumentList();
+    emitBytes(OP_CALL, argCount);
+}
+
+uint8_t Compiler::argumentList()
+{
+    uint8_t argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            expression();
+            if (argCount == UINT8_MAX)
+            {
+                error("Can't have more than 255 arguments.");
+            }
+            else
+            {
+                argCount++;
+            }
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
 void Compiler::namedVariable(const Token& name, bool canAssign)
 {
-    uint8_t getOp, setOp;
-    int arg = resolveLocal(name);
-    if (arg != -1)
+    uint8_t getOp, setOp, getLongOp, setLongOp;
+    int longWidth;
+    size_t arg;
+    int local = resolveLocal(m_function, name);
+    int upvalue = -1;
+    if (local != -1)
     {
+        arg = static_cast<size_t>(local);
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
+        getLongOp = OP_GET_LOCAL_LONG;
+        setLongOp = OP_SET_LOCAL_LONG;
+        longWidth = 2;
+    }
+    else if ((upvalue = resolveUpvalue(m_function, name)) != -1)
+    {
+        // at most 256 upvalues, so never a long operand
+        arg = static_cast<size_t>(upvalue);
+        getOp = getLongOp = OP_GET_UPVALUE;
+        setOp = setLongOp = OP_SET_UPVALUE;
+        longWidth = 1;
     }
     else
     {
-        arg = identifierConstant(name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        arg = globalSlot(name);
+        getOp = OP_GET_GLOBAL_SLOT;
+        setOp = OP_SET_GLOBAL_SLOT;
+        getLongOp = OP_GET_GLOBAL_SLOT_LONG;
+        setLongOp = OP_SET_GLOBAL_SLOT_LONG;
+        longWidth = 3;
     }
 
     if (canAssign && match(TOKEN_EQUAL))
     {
         expression();
-        emitBytes(setOp, static_cast<uint8_t>(arg));
+        emitOperandInstruction(setOp, setLongOp, arg, longWidth);
     }
     else
     {
-        emitBytes(getOp, static_cast<uint8_t>(arg));
+        emitOperandInstruction(getOp, getLongOp, arg, longWidth);
     }
 }
 
 void Compiler::beginScope()
 {
-    m_scopeDepth++;
+    m_function->scopeDepth++;
 }
 
 void Compiler::block()
@@ -452,26 +785,26 @@ void Compiler::block()
 
 void Compiler::endScope()
 {
-    m_scopeDepth--;
+    m_function->scopeDepth--;
 
-    while (m_localCount > 0 && m_locals[m_localCount - 1].depth > m_scopeDepth)
+    while (!m_function->locals.empty() && m_function->locals.back().depth > m_function->scopeDepth)
     {
-        emitByte(OP_POP);
-        m_localCount--;
+        emitByte(m_function->locals.back().isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+        m_function->locals.pop_back();
     }
 }
 
 void Compiler::declareVariable()
 {
-    if (m_scopeDepth == 0)
+    if (m_function->scopeDepth == 0)
         return;
 
     Token& name = m_parser.previous;
 
-    for (size_t i = m_localCount - 1; i >= 0; i--)
+    for (int i = static_cast<int>(m_function->locals.size()) - 1; i >= 0; i--)
     {
-        Local& local = m_locals[i];
-        if (local.depth != -1 && local.depth < m_scopeDepth)
+        Local& local = m_function->locals[i];
+        if (local.depth != -1 && local.depth < m_function->scopeDepth)
             break;
 
         if (identifiersEqual(name, local.name))
@@ -485,17 +818,14 @@ void Compiler::declareVariable()
 
 void Compiler::addLocal(const Token& name)
 {
-#define UINT8_COUNT (UINT8_MAX + 1)
-    if (m_localCount == UINT8_COUNT) // TODO i dont think this is needed because of vector?
+    // slots are addressed with at most a 16-bit operand, and the whole frame has to fit on the VM's stack
+    if (m_function->locals.size() == std::min<size_t>(UINT16_MAX + 1, VM::STACK_MAX))
     {
         error("Too many local variables in function.");
         return;
     }
 
-    Local& local = m_locals[m_localCount++];
-    local.name = name;
-    local.depth = -1;
-#undef UINT8_COUNT
+    m_function->locals.push_back(Local{name, -1});
 }
 
 bool Compiler::identifiersEqual(const Token& a, const Token& b)
@@ -506,11 +836,11 @@ bool Compiler::identifiersEqual(const Token& a, const Token& b)
     return std::strncmp(a.start, b.start, a.length) == 0;
 }
 
-int Compiler::resolveLocal(const Token& name)
+int Compiler::resolveLocal(FunctionScope* scope, const Token& name)
 {
-    for (size_t i = m_localCount - 1; i >= 0; i--)
+    for (int i = static_cast<int>(scope->locals.size()) - 1; i >= 0; i--)
     {
-        Local& local = m_locals[i];
+        Local& local = scope->locals[i];
         if (identifiersEqual(name, local.name))
         {
             if (local.depth == -1)
@@ -524,12 +854,52 @@ int Compiler::resolveLocal(const Token& name)
     return -1;
 }
 
+// Finds `name` in an enclosing function and threads it through an upvalue of every function in between, so
+// each closure captures from the frame that directly encloses it.
+int Compiler::resolveUpvalue(FunctionScope* scope, const Token& name)
+{
+    if (scope->enclosing == nullptr)
+        return -1;
+
+    int local = resolveLocal(scope->enclosing, name);
+    if (local != -1)
+    {
+        scope->enclosing->locals[static_cast<size_t>(local)].isCaptured = true;
+        return addUpvalue(scope, static_cast<size_t>(local), true);
+    }
+
+    int upvalue = resolveUpvalue(scope->enclosing, name);
+    if (upvalue != -1)
+        return addUpvalue(scope, static_cast<size_t>(upvalue), false);
+
+    return -1;
+}
+
+int Compiler::addUpvalue(FunctionScope* scope, size_t index, bool isLocal)
+{
+    std::vector<UpvalueCapture>& upvalues = scope->function->upvalues;
+    for (size_t i = 0; i < upvalues.size(); i++)
+    {
+        if (upvalues[i].index == index && upvalues[i].isLocal == isLocal)
+            return static_cast<int>(i);
+    }
+
+    if (upvalues.size() == UINT8_MAX + 1)
+    {
+        error("Too many closure variables in function.");
+        return 0;
+    }
+
+    upvalues.push_back(UpvalueCapture{isLocal, static_cast<uint16_t>(index)});
+    return static_cast<int>(upvalues.size() - 1);
+}
+
 void Compiler::markInitialized()
 {
-    if (m_scopeDepth == 0)
+    if (m_function->scopeDepth == 0)
         return;
 
-    m_locals[m_localCount - 1].depth = m_scopeDepth;
+    m_function->locals.back().depth = m_function->scopeDepth;
 }
 
 void Compiler::ifStatement()
@@ -538,14 +908,12 @@ void Compiler::ifStatement()
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    size_t thenJump = emitConditionJump();
     statement();
 
-    int elseJump = emitJump(OP_JUMP);
+    size_t elseJump = emitJump(OP_JUMP);
 
     patchJump(thenJump);
-    emitByte(OP_POP);
 
     if (match(TOKEN_ELSE))
         statement();
@@ -553,24 +921,69 @@ void Compiler::ifStatement()
     patchJump(elseJump);
 }
 
-int Compiler::emitJump(uint8_t instruction)
+size_t Compiler::emitJump(uint8_t instruction)
 {
     emitByte(instruction);
     emitByte(0xff);
     emitByte(0xff);
-    return m_currentChunk->code.size() - 2;
+    emitByte(0xff);
+    emitByte(0xff);
+    return m_currentChunk->code.size() - 4;
 }
 
-void Compiler::patchJump(int offset)
+// Emits a jump taken when the condition just compiled is false, consuming the condition. A comparison right
+// before it is folded into the jump so no bool is pushed.
+size_t Compiler::emitConditionJump()
 {
-    // -2 to adjust for the bytecode for the jump offset itself.
-    int jump = m_currentChunk->code.size() - offset - 2;
+    uint8_t instruction = OP_POP_JUMP_IF_FALSE;
+    if (m_lastComparison && m_lastComparison->end == m_currentChunk->code.size())
+    {
+        switch (m_lastComparison->operatorType)
+        {
+        case TOKEN_EQUAL_EQUAL:
+            instruction = OP_JUMP_IF_NOT_EQUAL;
+            break;
+        case TOKEN_BANG_EQUAL:
+            instruction = OP_JUMP_IF_EQUAL;
+            break;
+        case TOKEN_GREATER:
+            instruction = OP_JUMP_IF_NOT_GREATER;
+            break;
+        case TOKEN_LESS:
+            instruction = OP_JUMP_IF_NOT_LESS;
+            break;
+        // `a <= b` compiles as !(a > b), and `a >= b` as !(a < b)
+        case TOKEN_LESS_EQUAL:
+            instruction = OP_JUMP_IF_GREATER;
+            break;
+        case TOKEN_GREATER_EQUAL:
+            instruction = OP_JUMP_IF_LESS;
+            break;
+        default:
+            break;
+        }
+        m_currentChunk->truncate(m_lastComparison->offset, m_currentChunk->constants.size());
+    }
+    m_lastComparison.reset();
+
+    return emitJump(instruction);
+}
+
+void Compiler::patchJump(size_t offset)
+{
+    // code before a jump target can be reached from elsewhere, so it must not be folded away
+    m_lastConstant.reset();
+
+    // -4 to adjust for the bytecode for the jump offset itself.
+    size_t jump = m_currentChunk->code.size() - offset - 4;
 
-    if (jump > UINT16_MAX)
+    if (jump > UINT32_MAX)
     {
         error("Too much code to jump over.");
     }
 
-    m_currentChunk->code[offset] = (jump >> 8) & 0xff;
-    m_currentChunk->code[offset + 1] = jump & 0xff;
+    m_currentChunk->code[offset] = (jump >> 24) & 0xff;
+    m_currentChunk->code[offset + 1] = (jump >> 16) & 0xff;
+    m_currentChunk->code[offset + 2] = (jump >> 8) & 0xff;
+    m_currentChunk->code[offset + 3] = jump & 0xff;
 }
\ No newline at end of file
@@ -1,36 +1,59 @@
 #pragma once
 
-#include <functional>
-#include <map>
+#include <array>
+#include <cstddef>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "chunk.hpp"
 #include "scanner.hpp"
 
 class VM;
+struct ObjFunction;
 
 class Compiler
 {
   public:
-    Compiler(VM& vm) : m_vm(vm), m_scanner(), m_currentChunk(nullptr)
+    Compiler(VM& vm, int optimizationLevel = 0)
+        : m_vm(vm), m_optimizationLevel(optimizationLevel), m_function(nullptr), m_scanner(), m_currentChunk(nullptr)
     {
     }
 
-    bool compile(const std::string& source, Chunk* chunk);
+    // `source` is borrowed for the duration of the call; nothing compiled into the chunk points back into it.
+    bool compile(std::string_view source, Chunk* chunk);
 
   private:
     VM& m_vm;
+    int m_optimizationLevel;
 
     struct Local
     {
         Token name;
         int depth;
+        bool isCaptured = false; // closed over by a nested function, so leaving its scope closes an upvalue
     };
 
-    std::vector<Local> m_locals;
-    size_t m_localCount;
-    int m_scopeDepth;
+    enum FunctionType
+    {
+        TYPE_FUNCTION,
+        TYPE_SCRIPT,
+    };
+
+    // The function being compiled; a nested declaration pushes a new one that points back at its enclosing
+    // function. Locals are numbered from the frame's first slot, which in a function holds the callee.
+    struct FunctionScope
+    {
+        FunctionScope* enclosing;
+        ObjFunction* function; // nullptr for the script
+        FunctionType type;
+        Chunk* chunk;
+        std::vector<Local> locals;
+        int scopeDepth;
+    };
+
+    FunctionScope* m_function;
     struct Parser
     {
         Token current;
@@ -54,18 +77,39 @@ class Compiler
         PREC_PRIMARY
     };
 
-    using ParseFn = std::function<void(Compiler*, bool)>;
+    using ParseFn = void (Compiler::*)(bool canAssign);
     struct ParseRule
     {
-        ParseFn prefix;
-        ParseFn infix;
-        Precedence precedence;
+        ParseFn prefix = nullptr;
+        ParseFn infix = nullptr;
+        Precedence precedence = PREC_NONE;
     };
 
     Scanner m_scanner;
     Parser m_parser;
     Chunk* m_currentChunk;
 
+    // The most recently emitted instruction that pushes a known value. When an operator's operands are
+    // all such loads, sitting back to back at the end of the chunk, they are folded into one load.
+    struct ConstantLoad
+    {
+        size_t offset;
+        size_t end;
+        size_t poolSize; // constants.size() before the load, so folding can drop constants it added
+        Value value;
+    };
+    std::optional<ConstantLoad> m_lastConstant;
+
+    // The comparison most recently emitted, so a conditional jump straight after it can replace it with a
+    // fused compare-and-branch instead of materializing the bool.
+    struct Comparison
+    {
+        size_t offset;
+        size_t end;
+        TokenType operatorType;
+    };
+    std::optional<Comparison> m_lastComparison;
+
     void advance();
     void consume(TokenType type, const char* message);
     void expression();
@@ -74,40 +118,53 @@ class Compiler
     void endCompiler();
     void emitReturn();
     void emitConstant(Value value);
+    void emitLoad(Value value);
+    bool lastConstant(ConstantLoad& load) const;
+    bool foldBinary(TokenType operatorType, Value a, Value b, Value& result);
+    void emitOperandInstruction(uint8_t instruction, uint8_t longInstruction, size_t operand, int longWidth);
 
     void errorAtCurrent(const char* message);
     void errorAt(const Token& token, const char* message);
     void error(const char* message);
     void synchronize();
 
-    uint8_t makeConstant(Value value);
+    size_t makeConstant(Value value);
 
     void declaration();
+    void funDeclaration();
+    void function(FunctionType type);
     void varDeclaration();
     void statement();
     void beginScope();
     void block();
     void endScope();
     void ifStatement();
-    int emitJump(uint8_t instruction);
-    void patchJump(int offset);
+    size_t emitJump(uint8_t instruction);
+    size_t emitConditionJump();
+    void patchJump(size_t offset);
 
     bool match(TokenType type);
     bool check(TokenType type);
     bool identifiersEqual(const Token& a, const Token& b);
     void parsePrecedence(Precedence precedence);
     void namedVariable(const Token& name, bool canAssign);
-    int resolveLocal(const Token& name);
+    int resolveLocal(FunctionScope* scope, const Token& name);
+    int resolveUpvalue(FunctionScope* scope, const Token& name);
+    int addUpvalue(FunctionScope* scope, size_t index, bool isLocal);
 
     void printStatement();
+    void returnStatement();
     void expressionStatement();
-    uint8_t parseVariable(const char* errorMessage);
-    uint8_t identifierConstant(const Token& name);
-    void defineVariable(uint8_t global);
+    size_t parseVariable(const char* errorMessage);
+    size_t globalSlot(const Token& name);
+    void defineVariable(size_t global);
     void declareVariable();
     void addLocal(const Token& name);
     void markInitialized();
 
+    // below 2^53, so every integer with this many digits is exactly a double
+    static constexpr ptrdiff_t MAX_EXACT_DIGITS = 15;
+
     void numberConstant(bool canAssign);
     void stringConstant(bool canAssign);
     void grouping(bool canAssign);
@@ -115,49 +172,9 @@ class Compiler
     void binary(bool canAssign);
     void literal(bool canAssign);
     void variable(bool canAssign);
+    void call(bool canAssign);
+    uint8_t argumentList();
 
-#define BIND_FN(fn) std::bind(&Compiler::fn, this, std::placeholders::_1)
-
-    const std::map<TokenType, ParseRule> rules = {
-        {TOKEN_LEFT_PAREN, {BIND_FN(grouping), nullptr, PREC_NONE}},
-        {TOKEN_RIGHT_PAREN, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_LEFT_BRACE, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_RIGHT_BRACE, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_COMMA, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_DOT, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_MINUS, {BIND_FN(unary), BIND_FN(binary), PREC_TERM}},
-        {TOKEN_PLUS, {nullptr, BIND_FN(binary), PREC_TERM}},
-        {TOKEN_SEMICOLON, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_SLASH, {nullptr, BIND_FN(binary), PREC_FACTOR}},
-        {TOKEN_STAR, {nullptr, BIND_FN(binary), PREC_FACTOR}},
-        {TOKEN_BANG, {BIND_FN(unary), nullptr, PREC_NONE}},
-        {TOKEN_BANG_EQUAL, {nullptr, BIND_FN(binary), PREC_EQUALITY}},
-        {TOKEN_EQUAL, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_EQUAL_EQUAL, {nullptr, BIND_FN(binary), PREC_EQUALITY}},
-        {TOKEN_GREATER, {nullptr, BIND_FN(binary), PREC_COMPARISON}},
-        {TOKEN_GREATER_EQUAL, {nullptr, BIND_FN(binary), PREC_COMPARISON}},
-        {TOKEN_LESS, {nullptr, BIND_FN(binary), PREC_COMPARISON}},
-        {TOKEN_LESS_EQUAL, {nullptr, BIND_FN(binary), PREC_COMPARISON}},
-        {TOKEN_IDENTIFIER, {BIND_FN(variable), nullptr, PREC_NONE}},
-        {TOKEN_STRING, {BIND_FN(stringConstant), nullptr, PREC_NONE}},
-        {TOKEN_NUMBER, {BIND_FN(numberConstant), nullptr, PREC_NONE}},
-        {TOKEN_AND, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_CLASS, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_ELSE, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_FALSE, {BIND_FN(literal), nullptr, PREC_NONE}},
-        {TOKEN_FOR, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_FUN, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_IF, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_NIL, {BIND_FN(literal), nullptr, PREC_NONE}},
-        {TOKEN_OR, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_PRINT, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_RETURN, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_SUPER, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_THIS, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_TRUE, {BIND_FN(literal), nullptr, PREC_NONE}},
-        {TOKEN_VAR, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_WHILE, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_ERROR, {nullptr, nullptr, PREC_NONE}},
-        {TOKEN_EOF, {nullptr, nullptr, PREC_NONE}},
-    };
+    // Indexed by TokenType; built once at compile time, see compiler.cpp.
+    static const std::array<ParseRule, TOKEN_EOF + 1> rules;
 };
@@ -3,12 +3,18 @@
 #include <iomanip>
 #include <iostream>
 
+#include "object.hpp"
 #include "value.hpp"
 
 static size_t simpleInstruction(const std::string& name, size_t offset);
-static size_t constantInstruction(const std::string& name, const Chunk& chunk, size_t offset);
-static size_t byteInstruction(const std::string& name, const Chunk& chunk, size_t offset);
-static size_t jumpInstruction(const std::string& name, int sign, const Chunk& chunk, size_t offset);
+static size_t constantInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset);
+static size_t constantLongInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset);
+static size_t byteInstruction(const std::string& name, const uint8_t* code, size_t offset);
+static size_t wideInstruction(const std::string& name, const uint8_t* code, size_t offset, int width);
+static size_t jumpInstruction(const std::string& name, int sign, const uint8_t* code, size_t offset);
+static size_t addLocalsInstruction(const std::string& name, const uint8_t* code, size_t offset);
+static size_t compareJumpInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset);
+static size_t closureInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset);
 
 void disassembleChunk(const Chunk& chunk, const std::string& name)
 {
@@ -21,23 +27,31 @@ void disassembleChunk(const Chunk& chunk, const std::string& name)
 }
 
 size_t disassembleInstruction(const Chunk& chunk, size_t offset)
+{
+    return disassembleInstruction(chunk, chunk.code.data(), offset);
+}
+
+size_t disassembleInstruction(const Chunk& chunk, const uint8_t* code, size_t offset)
 {
     std::cout << std::setfill('0') << std::setw(4) << offset << " ";
 
-    if (offset > 0 && chunk.lines[offset] == chunk.lines[offset - 1])
+    int line = chunk.getLine(offset);
+    if (offset > 0 && line == chunk.getLine(offset - 1))
     {
         std::cout << "   | ";
     }
     else
     {
-        std::cout << std::setfill(' ') << std::setw(4) << chunk.lines[offset] << " ";
+        std::cout << std::setfill(' ') << std::setw(4) << line << " ";
     }
 
-    uint8_t instruction = chunk.code[offset];
+    uint8_t instruction = code[offset];
     switch (instruction)
     {
     case OP_CONSTANT:
-        return constantInstruction("OP_CONSTANT", chunk, offset);
+        return constantInstruction("OP_CONSTANT", chunk, code, offset);
+    case OP_CONSTANT_LONG:
+        return constantLongInstruction("OP_CONSTANT_LONG", chunk, code, offset);
     case OP_NIL:
         return simpleInstruction("OP_NIL", offset);
     case OP_TRUE:
@@ -47,23 +61,47 @@ size_t disassembleInstruction(const Chunk& chunk, size_t offset)
     case OP_POP:
         return simpleInstruction("OP_POP", offset);
     case OP_GET_LOCAL:
-        return byteInstruction("OP_GET_LOCAL", chunk, offset);
+        return byteInstruction("OP_GET_LOCAL", code, offset);
     case OP_SET_LOCAL:
-        return byteInstruction("OP_SET_LOCAL", chunk, offset);
-    case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-    case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-    case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        return byteInstruction("OP_SET_LOCAL", code, offset);
+    case OP_GET_LOCAL_LONG:
+        return wideInstruction("OP_GET_LOCAL_LONG", code, offset, 2);
+    case OP_SET_LOCAL_LONG:
+        return wideInstruction("OP_SET_LOCAL_LONG", code, offset, 2);
+    case OP_GET_GLOBAL_SLOT:
+        return byteInstruction("OP_GET_GLOBAL_SLOT", code, offset);
+    case OP_DEFINE_GLOBAL_SLOT:
+        return byteInstruction("OP_DEFINE_GLOBAL_SLOT", code, offset);
+    case OP_SET_GLOBAL_SLOT:
+        return byteInstruction("OP_SET_GLOBAL_SLOT", code, offset);
+    case OP_GET_GLOBAL_SLOT_LONG:
+        return wideInstruction("OP_GET_GLOBAL_SLOT_LONG", code, offset, 3);
+    case OP_DEFINE_GLOBAL_SLOT_LONG:
+        return wideInstruction("OP_DEFINE_GLOBAL_SLOT_LONG", code, offset, 3);
+    case OP_SET_GLOBAL_SLOT_LONG:
+        return wideInstruction("OP_SET_GLOBAL_SLOT_LONG", code, offset, 3);
+    case OP_GET_UPVALUE:
+        return byteInstruction("OP_GET_UPVALUE", code, offset);
+    case OP_SET_UPVALUE:
+        return byteInstruction("OP_SET_UPVALUE", code, offset);
     case OP_EQUAL:
         return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
         return simpleInstruction("OP_GREATER", offset);
     case OP_LESS:
         return simpleInstruction("OP_LESS", offset);
+    case OP_NOT_EQUAL:
+        return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER_EQUAL:
+        return simpleInstruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS_EQUAL:
+        return simpleInstruction("OP_LESS_EQUAL", offset);
     case OP_ADD:
         return simpleInstruction("OP_ADD", offset);
+    case OP_ADD_NUM:
+        return simpleInstruction("OP_ADD_NUM", offset);
+    case OP_ADD_STR:
+        return simpleInstruction("OP_ADD_STR", offset);
     case OP_SUBTRACT:
         return simpleInstruction("OP_SUBTRACT", offset);
     case OP_MULTIPLY:
@@ -77,9 +115,35 @@ size_t disassembleInstruction(const Chunk& chunk, size_t offset)
     case OP_PRINT:
         return simpleInstruction("OP_PRINT", offset);
     case OP_JUMP:
-        return jumpInstruction("OP_JUMP", 1, chunk, offset);
+        return jumpInstruction("OP_JUMP", 1, code, offset);
     case OP_JUMP_IF_FALSE:
-        return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        return jumpInstruction("OP_JUMP_IF_FALSE", 1, code, offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, code, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, code, offset);
+    case OP_JUMP_IF_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_EQUAL", 1, code, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, code, offset);
+    case OP_JUMP_IF_NOT_LESS:
+        return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, code, offset);
+    case OP_JUMP_IF_GREATER:
+        return jumpInstruction("OP_JUMP_IF_GREATER", 1, code, offset);
+    case OP_JUMP_IF_LESS:
+        return jumpInstruction("OP_JUMP_IF_LESS", 1, code, offset);
+    case OP_ADD_LOCALS:
+        return addLocalsInstruction("OP_ADD_LOCALS", code, offset);
+    case OP_LESS_LOCAL_CONST_JUMP:
+        return compareJumpInstruction("OP_LESS_LOCAL_CONST_JUMP", chunk, code, offset);
+    case OP_CLOSURE:
+        return closureInstruction("OP_CLOSURE", chunk, code, offset);
+    case OP_CLOSURE_LONG:
+        return closureInstruction("OP_CLOSURE_LONG", chunk, code, offset);
+    case OP_CLOSE_UPVALUE:
+        return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+    case OP_CALL:
+        return byteInstruction("OP_CALL", code, offset);
     case OP_RETURN:
         return simpleInstruction("OP_RETURN", offset);
     default:
@@ -94,9 +158,9 @@ static size_t simpleInstruction(const std::string& name, size_t offset)
     return offset + 1;
 }
 
-static size_t constantInstruction(const std::string& name, const Chunk& chunk, size_t offset)
+static size_t constantInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset)
 {
-    uint8_t constant = chunk.code[offset + 1];
+    uint8_t constant = code[offset + 1];
 
     std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
               << std::setfill(' ') << static_cast<int>(constant) << " '";
@@ -107,9 +171,22 @@ static size_t constantInstruction(const std::string& name, const Chunk& chunk, s
     return offset + 2;
 }
 
-static size_t byteInstruction(const std::string& name, const Chunk& chunk, size_t offset)
+static size_t constantLongInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset)
 {
-    uint8_t slot = chunk.code[offset + 1];
+    uint32_t constant = (code[offset + 1] << 16) | (code[offset + 2] << 8) | code[offset + 3];
+
+    std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
+              << std::setfill(' ') << constant << " '";
+    Value val = chunk.constants[constant];
+    printValue(val);
+    std::cout << "'" << std::endl;
+
+    return offset + 4;
+}
+
+static size_t byteInstruction(const std::string& name, const uint8_t* code, size_t offset)
+{
+    uint8_t slot = code[offset + 1];
 
     std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
               << std::setfill(' ') << static_cast<int>(slot) << std::endl;
@@ -117,13 +194,178 @@ static size_t byteInstruction(const std::string& name, const Chunk& chunk, size_
     return offset + 2;
 }
 
-static size_t jumpInstruction(const std::string& name, int sign, const Chunk& chunk, size_t offset)
+// big-endian operand of `width` bytes, used by the _LONG slot instructions
+static size_t wideInstruction(const std::string& name, const uint8_t* code, size_t offset, int width)
 {
-    uint16_t jump = static_cast<uint16_t>(chunk.code[offset + 1] << 8);
-    jump |= chunk.code[offset + 2];
+    uint32_t slot = 0;
+    for (int i = 1; i <= width; i++)
+    {
+        slot = (slot << 8) | code[offset + i];
+    }
 
     std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
-              << std::setfill(' ') << static_cast<int>(offset) << " -> " << (offset + 3 + sign * jump) << std::endl;
+              << std::setfill(' ') << slot << std::endl;
+
+    return offset + 1 + width;
+}
+
+static size_t jumpInstruction(const std::string& name, int sign, const uint8_t* code, size_t offset)
+{
+    int64_t jump = readJumpOffset(code, offset);
+
+    std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
+              << std::setfill(' ') << static_cast<int>(offset) << " -> "
+              << (static_cast<int64_t>(offset) + 5 + sign * jump) << std::endl;
+
+    return offset + 5;
+}
+
+static size_t addLocalsInstruction(const std::string& name, const uint8_t* code, size_t offset)
+{
+    std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
+              << std::setfill(' ') << static_cast<int>(code[offset + 1]) << " "
+              << static_cast<int>(code[offset + 2]) << std::endl;
 
     return offset + 3;
+}
+
+// local slot, constant index, then a forward jump taken when the comparison is false
+static size_t compareJumpInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset)
+{
+    uint8_t slot = code[offset + 1];
+    uint8_t constant = code[offset + 2];
+    size_t next = offset + instructionLength(code[offset]);
+
+    std::cout << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right << std::setw(4)
+              << std::setfill(' ') << static_cast<int>(slot) << " '";
+    printValue(chunk.constants[constant]);
+    std::cout << "' -> " << next + readJumpOffset(code, offset) << std::endl;
+
+    return next;
+}
+
+// The function constant, then one line per upvalue the closure captures.
+static size_t closureInstruction(const std::string& name, const Chunk& chunk, const uint8_t* code, size_t offset)
+{
+    bool isLong = code[offset] == OP_CLOSURE_LONG;
+    uint32_t constant =
+        isLong ? (code[offset + 1] << 16) | (code[offset + 2] << 8) | code[offset + 3] : code[offset + 1];
+    size_t next = isLong ? constantLongInstruction(name, chunk, code, offset)
+                         : constantInstruction(name, chunk, code, offset);
+
+    const ObjFunction* function = static_cast<const ObjFunction*>(chunk.constants[constant].asObj());
+    for (const UpvalueCapture& capture : function->upvalues)
+    {
+        std::cout << "     |                     " << (capture.isLocal ? "local " : "upvalue ") << capture.index
+                  << std::endl;
+    }
+
+    return next;
+}
+
+const char* opcodeName(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+        return "OP_CONSTANT";
+    case OP_CONSTANT_LONG:
+        return "OP_CONSTANT_LONG";
+    case OP_NIL:
+        return "OP_NIL";
+    case OP_TRUE:
+        return "OP_TRUE";
+    case OP_FALSE:
+        return "OP_FALSE";
+    case OP_POP:
+        return "OP_POP";
+    case OP_GET_LOCAL:
+        return "OP_GET_LOCAL";
+    case OP_SET_LOCAL:
+        return "OP_SET_LOCAL";
+    case OP_GET_LOCAL_LONG:
+        return "OP_GET_LOCAL_LONG";
+    case OP_SET_LOCAL_LONG:
+        return "OP_SET_LOCAL_LONG";
+    case OP_GET_GLOBAL_SLOT:
+        return "OP_GET_GLOBAL_SLOT";
+    case OP_DEFINE_GLOBAL_SLOT:
+        return "OP_DEFINE_GLOBAL_SLOT";
+    case OP_SET_GLOBAL_SLOT:
+        return "OP_SET_GLOBAL_SLOT";
+    case OP_GET_GLOBAL_SLOT_LONG:
+        return "OP_GET_GLOBAL_SLOT_LONG";
+    case OP_DEFINE_GLOBAL_SLOT_LONG:
+        return "OP_DEFINE_GLOBAL_SLOT_LONG";
+    case OP_SET_GLOBAL_SLOT_LONG:
+        return "OP_SET_GLOBAL_SLOT_LONG";
+    case OP_GET_UPVALUE:
+        return "OP_GET_UPVALUE";
+    case OP_SET_UPVALUE:
+        return "OP_SET_UPVALUE";
+    case OP_EQUAL:
+        return "OP_EQUAL";
+    case OP_GREATER:
+        return "OP_GREATER";
+    case OP_LESS:
+        return "OP_LESS";
+    case OP_NOT_EQUAL:
+        return "OP_NOT_EQUAL";
+    case OP_GREATER_EQUAL:
+        return "OP_GREATER_EQUAL";
+    case OP_LESS_EQUAL:
+        return "OP_LESS_EQUAL";
+    case OP_ADD:
+        return "OP_ADD";
+    case OP_ADD_NUM:
+        return "OP_ADD_NUM";
+    case OP_ADD_STR:
+        return "OP_ADD_STR";
+    case OP_SUBTRACT:
+        return "OP_SUBTRACT";
+    case OP_MULTIPLY:
+        return "OP_MULTIPLY";
+    case OP_DIVIDE:
+        return "OP_DIVIDE";
+    case OP_NOT:
+        return "OP_NOT";
+    case OP_NEGATE:
+        return "OP_NEGATE";
+    case OP_PRINT:
+        return "OP_PRINT";
+    case OP_JUMP:
+        return "OP_JUMP";
+    case OP_JUMP_IF_FALSE:
+        return "OP_JUMP_IF_FALSE";
+    case OP_POP_JUMP_IF_FALSE:
+        return "OP_POP_JUMP_IF_FALSE";
+    case OP_JUMP_IF_NOT_EQUAL:
+        return "OP_JUMP_IF_NOT_EQUAL";
+    case OP_JUMP_IF_EQUAL:
+        return "OP_JUMP_IF_EQUAL";
+    case OP_JUMP_IF_NOT_GREATER:
+        return "OP_JUMP_IF_NOT_GREATER";
+    case OP_JUMP_IF_NOT_LESS:
+        return "OP_JUMP_IF_NOT_LESS";
+    case OP_JUMP_IF_GREATER:
+        return "OP_JUMP_IF_GREATER";
+    case OP_JUMP_IF_LESS:
+        return "OP_JUMP_IF_LESS";
+    case OP_ADD_LOCALS:
+        return "OP_ADD_LOCALS";
+    case OP_LESS_LOCAL_CONST_JUMP:
+        return "OP_LESS_LOCAL_CONST_JUMP";
+    case OP_CLOSURE:
+        return "OP_CLOSURE";
+    case OP_CLOSURE_LONG:
+        return "OP_CLOSURE_LONG";
+    case OP_CLOSE_UPVALUE:
+        return "OP_CLOSE_UPVALUE";
+    case OP_CALL:
+        return "OP_CALL";
+    case OP_RETURN:
+        return "OP_RETURN";
+    default:
+        return "OP_UNKNOWN";
+    }
 }
\ No newline at end of file
@@ -5,4 +5,7 @@
 #include "chunk.hpp"
 
 void disassembleChunk(const Chunk& chunk, const std::string& name);
-size_t disassembleInstruction(const Chunk& chunk, size_t offset);
\ No newline at end of file
+size_t disassembleInstruction(const Chunk& chunk, size_t offset);
+// for code that does not live in chunk.code, such as a chunk executed from a mapped .loxc file
+size_t disassembleInstruction(const Chunk& chunk, const uint8_t* code, size_t offset);
+const char* opcodeName(uint8_t instruction);
@@ -1,30 +1,91 @@
 #include "common.hpp"
 
+#include "cache.hpp"
 #include "chunk.hpp"
 #include "debug.hpp"
+#include "serializer.hpp"
+#include "source.hpp"
 #include "vm.hpp"
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 static void repl(VM& vm);
-static void runFile(const char* path, VM& vm);
+static void runFile(const char* path, VM& vm, ChunkCache* cache);
+static void compileFile(const char* path, VM& vm);
+
+static void usage()
+{
+    std::cout << "Usage: cpplox [-O<level>] [-R] [--compile] [--no-cache] [--cache-stats] [path]" << std::endl;
+    exit(64);
+}
 
 int main(int argc, char* argv[])
 {
     VM vm = VM();
 
-    if (argc == 1)
+    bool compileOnly = false;
+    bool useCache = true;
+    bool cacheStats = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++)
+    {
+        if (std::strncmp(argv[arg], "-O", 2) == 0)
+        {
+            const char* level = argv[arg] + 2;
+            if (*level == '\0' || std::strspn(level, "0123456789") != std::strlen(level))
+                usage();
+
+            vm.setOptimizationLevel(std::atoi(level));
+        }
+        else if (std::strcmp(argv[arg], "-R") == 0)
+        {
+            vm.setRegisterMode(true);
+        }
+        else if (std::strcmp(argv[arg], "--compile") == 0)
+        {
+            compileOnly = true;
+        }
+        else if (std::strcmp(argv[arg], "--no-cache") == 0)
+        {
+            useCache = false;
+        }
+        else if (std::strcmp(argv[arg], "--cache-stats") == 0)
+        {
+            cacheStats = true;
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    if (compileOnly)
+    {
+        if (arg + 1 != argc)
+            usage();
+
+        compileFile(argv[arg], vm);
+        return 0;
+    }
+
+    if (arg == argc)
     {
         repl(vm);
     }
-    else if (argc == 2)
+    else if (arg + 1 == argc)
     {
-        runFile(argv[1], vm);
+        ChunkCache cache;
+        runFile(argv[arg], vm, useCache ? &cache : nullptr);
+        if (cacheStats)
+        {
+            std::cerr << "cache: " << cache.hits() << " hits, " << cache.misses() << " misses, " << cache.evictions()
+                      << " evictions" << std::endl;
+        }
     }
     else
     {
-        std::cout << "Usage: cpplox [path]" << std::endl;
-        exit(64);
+        usage();
     }
 
     Chunk chunk = Chunk();
@@ -54,30 +115,99 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-static void runFile(const char* path, VM& vm)
+static bool hasExtension(const std::string& path, const std::string& extension)
 {
-    std::ifstream file_stream(path);
+    return path.size() >= extension.size() &&
+           path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+static void exitOnError(InterpretResult result)
+{
+    if (result == InterpretResult::INTERPRET_COMPILE_ERROR)
+    {
+        exit(65);
+    }
 
-    if (file_stream.is_open())
+    if (result == InterpretResult::INTERPRET_RUNTIME_ERROR)
     {
-        std::string file_contents((std::istreambuf_iterator<char>(file_stream)), (std::istreambuf_iterator<char>()));
-        file_stream.close();
+        exit(70);
+    }
+}
 
-        InterpretResult result = vm.interpret(file_contents);
+// Scripts are looked up in the chunk cache first, if there is one, and compiled and added to it on a miss. A path
+// of "-" reads the script from stdin.
+static void runFile(const char* path, VM& vm, ChunkCache* cache)
+{
+    if (hasExtension(path, ".loxc"))
+    {
+        ChunkFile file(path);
+        if (!file.isOpen())
+        {
+            std::cout << "Error: Unable to open the file." << std::endl;
+            return;
+        }
 
+        InterpretResult result = vm.interpret(file);
         if (result == InterpretResult::INTERPRET_COMPILE_ERROR)
+        {
+            std::cout << "Error: " << file.error() << std::endl;
+        }
+
+        exitOnError(result);
+        return;
+    }
+
+    Chunk chunk;
+    {
+        SourceFile source(path);
+        if (!source.isOpen())
+        {
+            std::cout << "Error: Unable to open the file." << std::endl;
+            return;
+        }
+
+        InterpretResult result;
+        if (cache && cache->run(vm, source.text(), result))
+        {
+            exitOnError(result);
+            return;
+        }
+
+        if (!vm.compile(source.text(), chunk))
         {
             exit(65);
         }
 
-        if (result == InterpretResult::INTERPRET_RUNTIME_ERROR)
+        if (cache)
         {
-            exit(70);
+            cache->store(vm, source.text(), chunk);
         }
-    }
-    else
+    } // the text can be unmapped once it is compiled
+
+    exitOnError(vm.interpret(&chunk));
+}
+
+// Writes script.lox's chunk to script.loxc, which runFile then executes without recompiling.
+static void compileFile(const char* path, VM& vm)
+{
+    SourceFile source(path);
+    if (!source.isOpen())
     {
         std::cout << "Error: Unable to open the file." << std::endl;
+        exit(74);
+    }
+
+    Chunk chunk;
+    if (!vm.compile(source.text(), chunk))
+    {
+        exit(65);
+    }
+
+    std::string output = hasExtension(path, ".lox") ? std::string(path) + "c" : std::string(path) + ".loxc";
+    if (!writeChunkFile(chunk, vm.globalNames(), output))
+    {
+        std::cout << "Error: Unable to write \"" << output << "\"." << std::endl;
+        exit(74);
     }
 }
 
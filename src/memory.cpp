@@ -0,0 +1,212 @@
+#include "vm.hpp"
+
+#include "common.hpp"
+#include "object.hpp"
+
+#define GC_HEAP_GROW_FACTOR 2
+
+size_t VM::objectSize(Obj* object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+        return sizeof(ObjString) + static_cast<ObjString*>(object)->str.capacity();
+    case OBJ_FUNCTION:
+        return sizeof(ObjFunction);
+    case OBJ_NATIVE:
+        return sizeof(ObjNative);
+    case OBJ_CLOSURE:
+        return sizeof(ObjClosure) + static_cast<ObjClosure*>(object)->upvalues.capacity() * sizeof(ObjUpvalue*);
+    case OBJ_UPVALUE:
+        return sizeof(ObjUpvalue);
+    }
+
+    return sizeof(Obj);
+}
+
+void VM::collectGarbage()
+{
+#ifdef DEBUG_LOG_GC
+    std::cout << "-- gc begin" << std::endl;
+    size_t before = m_bytesAllocated;
+#endif
+
+    markRoots();
+    traceReferences();
+    m_strings.removeUnmarked();
+    sweep();
+
+    m_nextGC = m_bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+#ifdef DEBUG_LOG_GC
+    std::cout << "-- gc end" << std::endl;
+    std::cout << "   collected " << before - m_bytesAllocated << " bytes (from " << before << " to "
+              << m_bytesAllocated << ") next at " << m_nextGC << std::endl;
+#endif
+}
+
+void VM::markRoots()
+{
+    for (Value* slot = m_stack; slot < m_stackTop; slot++)
+    {
+        markValue(*slot);
+    }
+
+    for (const Value& value : m_globalValues)
+    {
+        markValue(value);
+    }
+    markTable(m_globalSlots);
+
+    // the script's chunk is reachable only from its frame, or from m_currentChunk while it is being compiled
+    // or loaded; functions carry their own chunks
+    for (int i = 0; i < m_frameCount; i++)
+    {
+        markObject(m_frames[i].closure);
+        markChunk(*m_frames[i].chunk);
+    }
+
+    for (ObjUpvalue* upvalue = m_openUpvalues; upvalue != nullptr; upvalue = upvalue->nextUpvalue)
+    {
+        markObject(upvalue);
+    }
+
+    if (m_currentChunk != nullptr)
+    {
+        markChunk(*m_currentChunk);
+    }
+}
+
+void VM::markValue(Value value)
+{
+    if (value.isObj())
+    {
+        markObject(value.asObj());
+    }
+}
+
+void VM::markObject(Obj* object)
+{
+    if (object == nullptr || object->isMarked)
+        return;
+
+#ifdef DEBUG_LOG_GC
+    std::cout << static_cast<void*>(object) << " mark ";
+    printValue(Value(object));
+    std::cout << std::endl;
+#endif
+
+    object->isMarked = true;
+    m_grayStack.push_back(object);
+}
+
+void VM::markChunk(const Chunk& chunk)
+{
+    for (const Value& constant : chunk.constants)
+    {
+        markValue(constant);
+    }
+}
+
+void VM::markTable(const Table& table)
+{
+    for (const Table::Entry& entry : table.entries())
+    {
+        markObject(entry.key);
+        markValue(entry.value);
+    }
+}
+
+void VM::traceReferences()
+{
+    while (!m_grayStack.empty())
+    {
+        Obj* object = m_grayStack.back();
+        m_grayStack.pop_back();
+        blackenObject(object);
+    }
+}
+
+void VM::blackenObject(Obj* object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+    case OBJ_NATIVE:
+        // hold no references
+        break;
+    case OBJ_FUNCTION: {
+        ObjFunction* function = static_cast<ObjFunction*>(object);
+        markObject(function->name);
+        markChunk(function->chunk);
+        break;
+    }
+    case OBJ_CLOSURE: {
+        ObjClosure* closure = static_cast<ObjClosure*>(object);
+        markObject(closure->function);
+        // entries are still null while OP_CLOSURE is capturing them
+        for (ObjUpvalue* upvalue : closure->upvalues)
+        {
+            markObject(upvalue);
+        }
+        break;
+    }
+    case OBJ_UPVALUE:
+        markValue(static_cast<ObjUpvalue*>(object)->closed);
+        break;
+    }
+}
+
+void VM::sweep()
+{
+    Obj* previous = nullptr;
+    Obj* object = m_objects;
+
+    while (object != nullptr)
+    {
+        if (object->isMarked)
+        {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+            continue;
+        }
+
+        Obj* unreached = object;
+        object = object->next;
+        if (previous != nullptr)
+        {
+            previous->next = object;
+        }
+        else
+        {
+            m_objects = object;
+        }
+
+        freeObject(unreached);
+    }
+}
+
+void VM::freeObject(Obj* object)
+{
+#ifdef DEBUG_LOG_GC
+    std::cout << static_cast<void*>(object) << " free type " << object->type << std::endl;
+#endif
+
+    m_bytesAllocated -= objectSize(object);
+    delete object;
+}
+
+void VM::freeVM()
+{
+    Obj* object = m_objects;
+    while (object != nullptr)
+    {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+
+    m_objects = nullptr;
+    m_grayStack.clear();
+}
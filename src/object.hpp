@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.hpp"
+#include "value.hpp"
+
+// Where each upvalue of a new closure comes from: a local slot of the frame creating it, or one of that
+// frame's closure's own upvalues.
+struct UpvalueCapture
+{
+    bool isLocal;
+    uint16_t index;
+};
+
+// A compiled function body. The top-level script is a bare Chunk rather than a function, so every ObjFunction
+// has a name. Functions only reach scripts wrapped in an ObjClosure.
+struct ObjFunction : Obj
+{
+    int arity = 0;
+    // read by OP_CLOSURE rather than encoded after it, so every instruction keeps a fixed length
+    std::vector<UpvalueCapture> upvalues;
+    Chunk chunk;
+    // the same code lowered for the register VM (-R), filled in by lowerToRegisters along with the script's
+    Chunk registerChunk;
+    ObjString* name;
+
+    explicit ObjFunction(ObjString* name) : Obj(OBJ_FUNCTION), name(name)
+    {
+    }
+};
+
+// Called with the arguments in place on the VM stack; `args` points at the first of `argCount` values.
+using NativeFn = Value (*)(int argCount, Value* args);
+
+struct ObjNative : Obj
+{
+    NativeFn function;
+
+    explicit ObjNative(NativeFn function) : Obj(OBJ_NATIVE), function(function)
+    {
+    }
+};
+
+// A captured variable. While open it points at the variable's stack slot, so the frame and every closure see
+// the same value; when the slot goes away the value moves into `closed` and location points there instead.
+struct ObjUpvalue : Obj
+{
+    Value* location;
+    Value closed;
+    ObjUpvalue* nextUpvalue = nullptr; // next open upvalue further down the stack
+
+    explicit ObjUpvalue(Value* slot) : Obj(OBJ_UPVALUE), location(slot)
+    {
+    }
+};
+
+struct ObjClosure : Obj
+{
+    ObjFunction* function;
+    // sized up front so the object's size never changes after allocation; filled in by VM::pushClosure
+    std::vector<ObjUpvalue*> upvalues;
+
+    explicit ObjClosure(ObjFunction* function)
+        : Obj(OBJ_CLOSURE), function(function), upvalues(function->upvalues.size(), nullptr)
+    {
+    }
+};
@@ -0,0 +1,285 @@
+#include "optimizer.hpp"
+
+#include <array>
+
+namespace
+{
+    struct Instruction
+    {
+        uint8_t op;
+        uint8_t length;
+        // operand bytes; for jumps the trailing offset is rebuilt from target when encoding
+        std::array<uint8_t, 6> operands;
+        int line;
+        // jumps only: index of the instruction they land on
+        size_t target = 0;
+        bool isJumpTarget = false;
+        bool removed = false;
+    };
+
+    // pushes a value without side effects, so a load immediately popped again can go
+    bool isPureLoad(uint8_t op)
+    {
+        switch (op)
+        {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_LOCAL_LONG:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    std::vector<Instruction> decode(const Chunk& chunk)
+    {
+        std::vector<Instruction> instructions;
+        std::vector<size_t> indexAt(chunk.code.size() + 1, SIZE_MAX);
+
+        for (size_t offset = 0; offset < chunk.code.size();)
+        {
+            Instruction instruction{};
+            instruction.op = chunk.code[offset];
+            instruction.length = static_cast<uint8_t>(instructionLength(instruction.op));
+            instruction.line = chunk.getLine(offset);
+            for (size_t i = 1; i < instruction.length; i++)
+            {
+                instruction.operands[i - 1] = chunk.code[offset + i];
+            }
+
+            indexAt[offset] = instructions.size();
+            instructions.push_back(instruction);
+            offset += instruction.length;
+        }
+        indexAt[chunk.code.size()] = instructions.size();
+
+        size_t offset = 0;
+        for (Instruction& instruction : instructions)
+        {
+            if (isJump(instruction.op))
+            {
+                instruction.target = indexAt[offset + instruction.length + readJumpOffset(chunk, offset)];
+            }
+            offset += instruction.length;
+        }
+
+        return instructions;
+    }
+
+    // Drops removed instructions, pointing any jump that landed on one at the next survivor, and
+    // recomputes which instructions are jump targets.
+    void compact(std::vector<Instruction>& instructions)
+    {
+        std::vector<size_t> newIndex(instructions.size() + 1);
+        size_t next = 0;
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            newIndex[i] = next;
+            if (!instructions[i].removed)
+                next++;
+        }
+        newIndex[instructions.size()] = next;
+
+        std::vector<Instruction> live;
+        for (Instruction& instruction : instructions)
+        {
+            if (instruction.removed)
+                continue;
+
+            instruction.target = newIndex[instruction.target];
+            instruction.isJumpTarget = false;
+            live.push_back(instruction);
+        }
+
+        for (const Instruction& instruction : live)
+        {
+            if (isJump(instruction.op) && instruction.target < live.size())
+                live[instruction.target].isJumpTarget = true;
+        }
+
+        instructions = std::move(live);
+    }
+
+    bool fuseComparisons(std::vector<Instruction>& instructions)
+    {
+        bool changed = false;
+        for (size_t i = 0; i + 1 < instructions.size(); i++)
+        {
+            Instruction& first = instructions[i];
+            Instruction& second = instructions[i + 1];
+            if (second.op != OP_NOT || second.isJumpTarget || first.removed)
+                continue;
+
+            switch (first.op)
+            {
+            case OP_EQUAL:
+                first.op = OP_NOT_EQUAL;
+                break;
+            case OP_LESS:
+                first.op = OP_GREATER_EQUAL;
+                break;
+            case OP_GREATER:
+                first.op = OP_LESS_EQUAL;
+                break;
+            default:
+                continue;
+            }
+
+            second.removed = true;
+            changed = true;
+        }
+
+        return changed;
+    }
+
+    bool removeDeadLoads(std::vector<Instruction>& instructions)
+    {
+        bool changed = false;
+        for (size_t i = 0; i + 1 < instructions.size(); i++)
+        {
+            Instruction& load = instructions[i];
+            Instruction& pop = instructions[i + 1];
+            if (load.removed || !isPureLoad(load.op) || pop.op != OP_POP || pop.isJumpTarget)
+                continue;
+
+            load.removed = true;
+            pop.removed = true;
+            changed = true;
+        }
+
+        return changed;
+    }
+
+    bool threadJumps(std::vector<Instruction>& instructions)
+    {
+        bool changed = false;
+        for (Instruction& instruction : instructions)
+        {
+            if (!isJump(instruction.op))
+                continue;
+
+            // bounded so a cycle of unconditional jumps cannot hang the compiler
+            for (size_t hops = 0; hops < instructions.size() && instruction.target < instructions.size(); hops++)
+            {
+                const Instruction& target = instructions[instruction.target];
+                if (target.op != OP_JUMP || target.target == instruction.target)
+                    break;
+
+                instruction.target = target.target;
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    // The superinstructions were picked from opcode trigram counts gathered by tools/OpcodeStats over our
+    // benchmark scripts: local + local arithmetic, and `local < constant` loop guards.
+    bool fuseSuperinstructions(std::vector<Instruction>& instructions)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            Instruction& first = instructions[i];
+            if (first.removed || first.op != OP_GET_LOCAL)
+                continue;
+
+            auto matches = [&](size_t distance, uint8_t op) {
+                return i + distance < instructions.size() && instructions[i + distance].op == op &&
+                       !instructions[i + distance].isJumpTarget;
+            };
+
+            if (matches(1, OP_GET_LOCAL) && matches(2, OP_ADD))
+            {
+                // GET_LOCAL a; GET_LOCAL b; ADD  ->  ADD_LOCALS a b
+                first.op = OP_ADD_LOCALS;
+                first.length = 3;
+                first.operands[1] = instructions[i + 1].operands[0];
+                instructions[i + 1].removed = true;
+                instructions[i + 2].removed = true;
+                changed = true;
+            }
+            else if (matches(1, OP_CONSTANT) && matches(2, OP_JUMP_IF_NOT_LESS))
+            {
+                // GET_LOCAL a; CONSTANT k; JUMP_IF_NOT_LESS t  ->  LESS_LOCAL_CONST_JUMP a k t
+                first.op = OP_LESS_LOCAL_CONST_JUMP;
+                first.length = 7;
+                first.operands[1] = instructions[i + 1].operands[0];
+                first.target = instructions[i + 2].target;
+                instructions[i + 1].removed = true;
+                instructions[i + 2].removed = true;
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    void encode(Chunk& chunk, const std::vector<Instruction>& instructions)
+    {
+        std::vector<size_t> offsets(instructions.size() + 1);
+        size_t offset = 0;
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            offsets[i] = offset;
+            offset += instructions[i].length;
+        }
+        offsets[instructions.size()] = offset;
+
+        chunk.code.clear();
+        chunk.lines.clear();
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            const Instruction& instruction = instructions[i];
+            chunk.writeChunk(instruction.op, instruction.line);
+
+            size_t operandBytes = isJump(instruction.op) ? instruction.length - 5u : instruction.length - 1u;
+            for (size_t j = 0; j < operandBytes; j++)
+            {
+                chunk.writeChunk(instruction.operands[j], instruction.line);
+            }
+
+            if (isJump(instruction.op))
+            {
+                uint32_t jump = static_cast<uint32_t>(offsets[instruction.target] - offsets[i + 1]);
+                chunk.writeChunk((jump >> 24) & 0xff, instruction.line);
+                chunk.writeChunk((jump >> 16) & 0xff, instruction.line);
+                chunk.writeChunk((jump >> 8) & 0xff, instruction.line);
+                chunk.writeChunk(jump & 0xff, instruction.line);
+            }
+        }
+    }
+} // namespace
+
+void optimizeChunk(Chunk& chunk, int level)
+{
+    if (level <= 0 || chunk.code.empty())
+        return;
+
+    std::vector<Instruction> instructions = decode(chunk);
+    compact(instructions);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        changed |= fuseComparisons(instructions);
+        compact(instructions);
+        changed |= removeDeadLoads(instructions);
+        compact(instructions);
+        changed |= threadJumps(instructions);
+        compact(instructions);
+
+        if (level >= 2)
+        {
+            changed |= fuseSuperinstructions(instructions);
+            compact(instructions);
+        }
+    }
+
+    encode(chunk, instructions);
+}
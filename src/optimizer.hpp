@@ -0,0 +1,8 @@
+#pragma once
+
+#include "chunk.hpp"
+
+// Peephole pass over a finished chunk, run by the compiler after endCompiler emits the final return.
+// Level 0 leaves the chunk untouched; level 1 removes dead loads, fuses negated comparisons and threads
+// jumps to jumps; level 2 also folds hot opcode sequences into superinstructions.
+void optimizeChunk(Chunk& chunk, int level);
@@ -0,0 +1,509 @@
+#include "registers.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "object.hpp"
+#include "value.hpp"
+
+namespace
+{
+    struct RegisterInstructionInfo
+    {
+        const char* name;
+        int operands; // one-byte operands, not counting a jump offset
+        bool jump;
+    };
+
+    // indexed by RegisterOpCode
+    constexpr RegisterInstructionInfo registerInstructions[] = {
+        {"REG_MOVE", 2, false},
+        {"REG_LOAD_CONSTANT", 2, false},
+        {"REG_LOAD_NIL", 1, false},
+        {"REG_LOAD_TRUE", 1, false},
+        {"REG_LOAD_FALSE", 1, false},
+        {"REG_GET_GLOBAL", 2, false},
+        {"REG_DEFINE_GLOBAL", 2, false},
+        {"REG_SET_GLOBAL", 2, false},
+        {"REG_EQUAL", 3, false},
+        {"REG_NOT_EQUAL", 3, false},
+        {"REG_GREATER", 3, false},
+        {"REG_GREATER_EQUAL", 3, false},
+        {"REG_LESS", 3, false},
+        {"REG_LESS_EQUAL", 3, false},
+        {"REG_ADD", 3, false},
+        {"REG_SUBTRACT", 3, false},
+        {"REG_MULTIPLY", 3, false},
+        {"REG_DIVIDE", 3, false},
+        {"REG_NOT", 2, false},
+        {"REG_NEGATE", 2, false},
+        {"REG_PRINT", 1, false},
+        {"REG_JUMP", 0, true},
+        {"REG_JUMP_IF_FALSE", 1, true},
+        {"REG_JUMP_IF_NOT_EQUAL", 2, true},
+        {"REG_JUMP_IF_EQUAL", 2, true},
+        {"REG_JUMP_IF_NOT_GREATER", 2, true},
+        {"REG_JUMP_IF_NOT_LESS", 2, true},
+        {"REG_JUMP_IF_GREATER", 2, true},
+        {"REG_JUMP_IF_LESS", 2, true},
+        {"REG_GET_UPVALUE", 2, false},
+        {"REG_SET_UPVALUE", 2, false},
+        {"REG_CLOSURE", 2, false},
+        {"REG_CLOSE_UPVALUE", 1, false},
+        {"REG_CALL", 2, false},
+        {"REG_RETURN", 1, false},
+    };
+    static_assert(sizeof(registerInstructions) / sizeof(registerInstructions[0]) == REG_RETURN + 1);
+
+    // Walks the stack code once, simulating the stack symbolically: each entry records the register that
+    // holds its value. A value normally lives in the register of its own stack position, but reading a local
+    // only pushes an alias of the local's register, so `a + b` over two locals needs no moves at all. Aliases
+    // are written out ("materialized") before the aliased local changes, and at every jump and jump target so
+    // that all paths meet with each value in its own register.
+    class Lowering
+    {
+      public:
+        // `entryDepth` values are already in place when the code starts: the callee and its arguments
+        Lowering(const Chunk& chunk, Chunk& out, size_t entryDepth) : m_chunk(chunk), m_out(out)
+        {
+            while (m_stack.size() < entryDepth)
+            {
+                push();
+            }
+        }
+
+        bool lower()
+        {
+            bool reachable = true;
+            std::unordered_map<size_t, size_t> offsets; // stack code offset -> register code offset
+
+            for (size_t offset = 0; offset < m_chunk.code.size(); offset += instructionLength(m_chunk.code[offset]))
+            {
+                offsets[offset] = m_out.code.size();
+                m_line = m_chunk.getLine(offset);
+
+                auto target = m_targetDepth.find(offset);
+                if (target != m_targetDepth.end())
+                {
+                    if (reachable)
+                        materializeAll();
+
+                    m_stack.clear();
+                    for (size_t position = 0; position < target->second; position++)
+                    {
+                        m_stack.push_back(position);
+                    }
+                    reachable = true;
+                }
+
+                // code after an unconditional jump that nothing jumps to
+                if (!reachable)
+                    continue;
+
+                if (!lowerInstruction(offset, reachable))
+                    return false;
+            }
+            offsets[m_chunk.code.size()] = m_out.code.size();
+
+            for (const Patch& patch : m_patches)
+            {
+                uint32_t jump = static_cast<uint32_t>(offsets[patch.target] - (patch.operand + 4));
+                m_out.code[patch.operand] = (jump >> 24) & 0xff;
+                m_out.code[patch.operand + 1] = (jump >> 16) & 0xff;
+                m_out.code[patch.operand + 2] = (jump >> 8) & 0xff;
+                m_out.code[patch.operand + 3] = jump & 0xff;
+            }
+
+            m_out.maxStackDepth = m_registerCount;
+            return m_fits;
+        }
+
+      private:
+        struct Patch
+        {
+            size_t operand; // offset of the jump's four offset bytes in the register code
+            size_t target;  // stack code offset it lands on
+        };
+
+        const Chunk& m_chunk;
+        Chunk& m_out;
+        std::vector<size_t> m_stack; // register holding each stack entry
+        std::unordered_map<size_t, size_t> m_targetDepth;
+        std::vector<Patch> m_patches;
+        size_t m_registerCount = 0;
+        int m_line = 0;
+        bool m_fits = true;
+
+        void emit(uint8_t instruction)
+        {
+            m_out.writeChunk(instruction, m_line);
+        }
+
+        template <typename... Operands>
+        void emit(uint8_t instruction, size_t operand, Operands... operands)
+        {
+            emit(instruction);
+            emitOperand(operand);
+            (emitOperand(operands), ...);
+        }
+
+        void emitOperand(size_t operand)
+        {
+            if (operand > UINT8_MAX)
+                m_fits = false;
+
+            m_out.writeChunk(static_cast<uint8_t>(operand), m_line);
+        }
+
+        template <typename... Operands>
+        void emitJump(size_t target, uint8_t instruction, Operands... operands)
+        {
+            materializeAll();
+            m_targetDepth[target] = m_stack.size();
+
+            emit(instruction, static_cast<size_t>(operands)...);
+            m_patches.push_back(Patch{m_out.code.size(), target});
+            for (int i = 0; i < 4; i++)
+            {
+                m_out.writeChunk(0xff, m_line);
+            }
+        }
+
+        size_t push()
+        {
+            m_stack.push_back(m_stack.size());
+            m_registerCount = std::max(m_registerCount, m_stack.size());
+            return m_stack.back();
+        }
+
+        size_t pop()
+        {
+            size_t reg = m_stack.back();
+            m_stack.pop_back();
+            return reg;
+        }
+
+        void materialize(size_t position)
+        {
+            if (m_stack[position] == position)
+                return;
+
+            emit(REG_MOVE, position, m_stack[position]);
+            m_stack[position] = position;
+            m_registerCount = std::max(m_registerCount, position + 1);
+        }
+
+        void materializeAll()
+        {
+            for (size_t position = 0; position < m_stack.size(); position++)
+            {
+                materialize(position);
+            }
+        }
+
+        // the register of a local slot, made to actually hold the local's value
+        size_t local(size_t slot)
+        {
+            materialize(slot);
+            return slot;
+        }
+
+        bool lowerInstruction(size_t offset, bool& reachable)
+        {
+            uint8_t instruction = m_chunk.code[offset];
+            const uint8_t* operand = m_chunk.code.data() + offset + 1;
+            size_t target = offset + instructionLength(instruction);
+            if (isJump(instruction))
+                target += readJumpOffset(m_chunk, offset);
+
+            switch (instruction)
+            {
+            case OP_CONSTANT:
+                emit(REG_LOAD_CONSTANT, push(), operand[0]);
+                break;
+            case OP_NIL:
+                emit(REG_LOAD_NIL, push());
+                break;
+            case OP_TRUE:
+                emit(REG_LOAD_TRUE, push());
+                break;
+            case OP_FALSE:
+                emit(REG_LOAD_FALSE, push());
+                break;
+            case OP_POP:
+                pop();
+                break;
+            case OP_GET_LOCAL:
+                m_stack.push_back(local(operand[0]));
+                break;
+            case OP_SET_LOCAL: {
+                size_t slot = operand[0];
+                for (size_t position = 0; position < m_stack.size(); position++)
+                {
+                    if (m_stack[position] == slot && position != slot)
+                        materialize(position);
+                }
+                if (m_stack.back() != slot)
+                    emit(REG_MOVE, slot, m_stack.back());
+                m_stack[slot] = slot;
+                break;
+            }
+            case OP_GET_GLOBAL_SLOT:
+                emit(REG_GET_GLOBAL, push(), operand[0]);
+                break;
+            case OP_DEFINE_GLOBAL_SLOT:
+                emit(REG_DEFINE_GLOBAL, operand[0], pop());
+                break;
+            case OP_SET_GLOBAL_SLOT:
+                emit(REG_SET_GLOBAL, operand[0], m_stack.back());
+                break;
+            case OP_EQUAL:
+                binary(REG_EQUAL);
+                break;
+            case OP_NOT_EQUAL:
+                binary(REG_NOT_EQUAL);
+                break;
+            case OP_GREATER:
+                binary(REG_GREATER);
+                break;
+            case OP_GREATER_EQUAL:
+                binary(REG_GREATER_EQUAL);
+                break;
+            case OP_LESS:
+                binary(REG_LESS);
+                break;
+            case OP_LESS_EQUAL:
+                binary(REG_LESS_EQUAL);
+                break;
+            case OP_ADD:
+                binary(REG_ADD);
+                break;
+            case OP_SUBTRACT:
+                binary(REG_SUBTRACT);
+                break;
+            case OP_MULTIPLY:
+                binary(REG_MULTIPLY);
+                break;
+            case OP_DIVIDE:
+                binary(REG_DIVIDE);
+                break;
+            case OP_NOT: {
+                size_t value = pop();
+                emit(REG_NOT, push(), value);
+                break;
+            }
+            case OP_NEGATE: {
+                size_t value = pop();
+                emit(REG_NEGATE, push(), value);
+                break;
+            }
+            case OP_PRINT:
+                emit(REG_PRINT, pop());
+                break;
+            case OP_ADD_LOCALS: {
+                size_t a = local(operand[0]);
+                size_t b = local(operand[1]);
+                emit(REG_ADD, push(), a, b);
+                break;
+            }
+            case OP_JUMP:
+                emitJump(target, REG_JUMP);
+                reachable = false;
+                break;
+            case OP_JUMP_IF_FALSE:
+                emitJump(target, REG_JUMP_IF_FALSE, m_stack.back());
+                break;
+            case OP_POP_JUMP_IF_FALSE: {
+                size_t condition = pop();
+                emitJump(target, REG_JUMP_IF_FALSE, condition);
+                break;
+            }
+            case OP_JUMP_IF_NOT_EQUAL:
+                compareJump(target, REG_JUMP_IF_NOT_EQUAL);
+                break;
+            case OP_JUMP_IF_EQUAL:
+                compareJump(target, REG_JUMP_IF_EQUAL);
+                break;
+            case OP_JUMP_IF_NOT_GREATER:
+                compareJump(target, REG_JUMP_IF_NOT_GREATER);
+                break;
+            case OP_JUMP_IF_NOT_LESS:
+                compareJump(target, REG_JUMP_IF_NOT_LESS);
+                break;
+            case OP_JUMP_IF_GREATER:
+                compareJump(target, REG_JUMP_IF_GREATER);
+                break;
+            case OP_JUMP_IF_LESS:
+                compareJump(target, REG_JUMP_IF_LESS);
+                break;
+            case OP_LESS_LOCAL_CONST_JUMP: {
+                size_t a = local(operand[0]);
+                size_t constant = push();
+                emit(REG_LOAD_CONSTANT, constant, operand[1]);
+                pop();
+                emitJump(target, REG_JUMP_IF_NOT_LESS, a, constant);
+                break;
+            }
+            case OP_GET_UPVALUE:
+                emit(REG_GET_UPVALUE, push(), operand[0]);
+                break;
+            case OP_SET_UPVALUE:
+                // upvalues only ever point into other frames' registers, so no alias here can go stale
+                emit(REG_SET_UPVALUE, operand[0], m_stack.back());
+                break;
+            case OP_CLOSURE: {
+                // captured locals are read from their registers; a function capturing itself captures the
+                // register the closure is about to land in
+                const ObjFunction* function = static_cast<const ObjFunction*>(m_chunk.constants[operand[0]].asObj());
+                for (const UpvalueCapture& capture : function->upvalues)
+                {
+                    if (capture.isLocal && capture.index < m_stack.size())
+                        materialize(capture.index);
+                }
+                emit(REG_CLOSURE, push(), operand[0]);
+                break;
+            }
+            case OP_CLOSE_UPVALUE:
+                materialize(m_stack.size() - 1);
+                emit(REG_CLOSE_UPVALUE, pop());
+                break;
+            case OP_CALL: {
+                // the callee may change any local through an upvalue, and takes its arguments from their own
+                // registers
+                size_t argCount = operand[0];
+                materializeAll();
+                size_t callee = m_stack.size() - argCount - 1;
+                m_stack.resize(callee);
+                emit(REG_CALL, push(), argCount);
+                break;
+            }
+            case OP_RETURN:
+                emit(REG_RETURN, pop());
+                reachable = false;
+                break;
+            default:
+                // the _LONG forms exist only once an operand outgrows a byte
+                return false;
+            }
+
+            return true;
+        }
+
+        void binary(uint8_t instruction)
+        {
+            size_t b = pop();
+            size_t a = pop();
+            emit(instruction, push(), a, b);
+        }
+
+        void compareJump(size_t target, uint8_t instruction)
+        {
+            size_t b = pop();
+            size_t a = pop();
+            emitJump(target, instruction, a, b);
+        }
+    };
+} // namespace
+
+size_t registerInstructionLength(uint8_t instruction)
+{
+    const RegisterInstructionInfo& info = registerInstructions[instruction];
+    return 1 + static_cast<size_t>(info.operands) + (info.jump ? 4 : 0);
+}
+
+static bool lowerChunk(const Chunk& chunk, Chunk& out, size_t entryDepth, [[maybe_unused]] const char* name)
+{
+    out.constants = chunk.constants;
+
+    Lowering lowering(chunk, out, entryDepth);
+    if (!lowering.lower())
+    {
+        out = Chunk();
+        return false;
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    disassembleRegisterChunk(out, name);
+#endif
+
+    // functions are reached through the constants of the chunks that create their closures
+    for (const Value& constant : chunk.constants)
+    {
+        if (!constant.isObj() || constant.asObj()->type != OBJ_FUNCTION)
+            continue;
+
+        ObjFunction* function = static_cast<ObjFunction*>(constant.asObj());
+        if (!function->registerChunk.code.empty())
+            continue;
+
+        if (!lowerChunk(function->chunk, function->registerChunk, function->arity + 1, function->name->str.c_str()))
+            return false;
+    }
+
+    return true;
+}
+
+bool lowerToRegisters(const Chunk& chunk, Chunk& out)
+{
+    return lowerChunk(chunk, out, 0, "registers");
+}
+
+bool lowerFunctionToRegisters(ObjFunction* function)
+{
+    lowerChunk(function->chunk, function->registerChunk, function->arity + 1, function->name->str.c_str());
+    return !function->registerChunk.code.empty();
+}
+
+size_t disassembleRegisterInstruction(const Chunk& chunk, size_t offset)
+{
+    std::cout << std::setfill('0') << std::setw(4) << offset << " ";
+
+    int line = chunk.getLine(offset);
+    if (offset > 0 && line == chunk.getLine(offset - 1))
+    {
+        std::cout << "   | ";
+    }
+    else
+    {
+        std::cout << std::setfill(' ') << std::setw(4) << line << " ";
+    }
+
+    uint8_t instruction = chunk.code[offset];
+    const RegisterInstructionInfo& info = registerInstructions[instruction];
+    std::cout << std::left << std::setw(24) << std::setfill(' ') << info.name << std::right;
+    for (int i = 1; i <= info.operands; i++)
+    {
+        std::cout << " " << std::setw(3) << static_cast<int>(chunk.code[offset + i]);
+    }
+
+    size_t next = offset + registerInstructionLength(instruction);
+    if (info.jump)
+    {
+        const uint8_t* jump = &chunk.code[next - 4];
+        size_t distance = (static_cast<size_t>(jump[0]) << 24) | (static_cast<size_t>(jump[1]) << 16) |
+                          (static_cast<size_t>(jump[2]) << 8) | jump[3];
+        std::cout << " -> " << next + distance;
+    }
+    if (instruction == REG_LOAD_CONSTANT)
+    {
+        std::cout << " '";
+        printValue(chunk.constants[chunk.code[offset + 2]]);
+        std::cout << "'";
+    }
+    std::cout << std::endl;
+
+    return next;
+}
+
+void disassembleRegisterChunk(const Chunk& chunk, const char* name)
+{
+    std::cout << "== " << name << " ==\n";
+
+    for (size_t offset = 0; offset < chunk.code.size();)
+    {
+        offset = disassembleRegisterInstruction(chunk, offset);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "chunk.hpp"
+
+struct ObjFunction;
+
+// Three-address instruction set over frame registers, an alternative to the stack bytecode in chunk.hpp.
+// Registers are the VM stack slots of the frame, so a local's register is its stack slot. Operands are one
+// byte each (a = destination, b/c = sources, k = constant index, g = global slot); jump offsets are four
+// bytes, always last, and measured from the end of the instruction like the stack jumps.
+enum RegisterOpCode : uint8_t
+{
+    REG_MOVE,          // a b       R[a] = R[b]
+    REG_LOAD_CONSTANT, // a k       R[a] = K[k]
+    REG_LOAD_NIL,      // a
+    REG_LOAD_TRUE,     // a
+    REG_LOAD_FALSE,    // a
+    REG_GET_GLOBAL,    // a g
+    REG_DEFINE_GLOBAL, // g a
+    REG_SET_GLOBAL,    // g a
+    REG_EQUAL,         // a b c     R[a] = R[b] == R[c]
+    REG_NOT_EQUAL,     // a b c
+    REG_GREATER,       // a b c
+    REG_GREATER_EQUAL, // a b c
+    REG_LESS,          // a b c
+    REG_LESS_EQUAL,    // a b c
+    REG_ADD,           // a b c
+    REG_SUBTRACT,      // a b c
+    REG_MULTIPLY,      // a b c
+    REG_DIVIDE,        // a b c
+    REG_NOT,           // a b       R[a] = !R[b]
+    REG_NEGATE,        // a b
+    REG_PRINT,         // a
+    REG_JUMP,          // offset
+    REG_JUMP_IF_FALSE, // a offset
+    // b c offset, jump when the comparison is false; the same conditions as the stack OP_JUMP_IF_* opcodes
+    REG_JUMP_IF_NOT_EQUAL,
+    REG_JUMP_IF_EQUAL,
+    REG_JUMP_IF_NOT_GREATER,
+    REG_JUMP_IF_NOT_LESS,
+    REG_JUMP_IF_GREATER,
+    REG_JUMP_IF_LESS,
+    REG_GET_UPVALUE,   // a u       R[a] = upvalue u of the running closure
+    REG_SET_UPVALUE,   // u b
+    REG_CLOSURE,       // a k       R[a] = a new closure over the function K[k], capturing from this frame
+    REG_CLOSE_UPVALUE, // a         closes every upvalue at or above R[a]
+    // a n: calls R[a] with the n arguments in R[a+1]..R[a+n], leaving the result in R[a]; the callee's
+    // registers start at R[a], so it finds itself and its arguments in its own first registers
+    REG_CALL,
+    REG_RETURN, // a
+};
+
+size_t registerInstructionLength(uint8_t instruction);
+
+// Translates the script's finished stack bytecode into register code in `out`, which gets its own copy of the
+// constants and uses maxStackDepth for the number of registers; every function it can reach is lowered into
+// its ObjFunction::registerChunk. Returns false, leaving the stack code to be run instead, when some chunk
+// needs an operand wider than a byte.
+bool lowerToRegisters(const Chunk& chunk, Chunk& out);
+
+// Lowers a function into its registerChunk when the script that created it could not be lowered with it, e.g.
+// an earlier REPL line that ran as stack code. Returns false if the function's own code needs a wider operand;
+// functions it creates in turn are lowered when they are first called.
+bool lowerFunctionToRegisters(ObjFunction* function);
+
+void disassembleRegisterChunk(const Chunk& chunk, const char* name);
+size_t disassembleRegisterInstruction(const Chunk& chunk, size_t offset);
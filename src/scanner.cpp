@@ -1,5 +1,204 @@
 #include "scanner.hpp"
 
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "common.hpp"
+
+#ifdef SIMD_SCANNER
+#include <immintrin.h>
+#endif
+
+// Each helper returns the end of the run starting at `p`, classifying a whole block of bytes at a time while one
+// fits before `end` and finishing byte by byte.
+namespace
+{
+#ifdef SIMD_SCANNER
+#ifdef __AVX2__
+    using Bytes = __m256i;
+    constexpr ptrdiff_t BLOCK_SIZE = 32;
+
+    Bytes loadBytes(const char* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    Bytes splat(char c)
+    {
+        return _mm256_set1_epi8(c);
+    }
+
+    Bytes equal(Bytes bytes, char c)
+    {
+        return _mm256_cmpeq_epi8(bytes, splat(c));
+    }
+
+    Bytes either(Bytes a, Bytes b)
+    {
+        return _mm256_or_si256(a, b);
+    }
+
+    // signed compares, so bytes of 0x80 and up are negative and never inside an ASCII range
+    Bytes inRange(Bytes bytes, char low, char high)
+    {
+        Bytes aboveLow = _mm256_cmpgt_epi8(bytes, splat(static_cast<char>(low - 1)));
+        return _mm256_and_si256(aboveLow, _mm256_cmpgt_epi8(splat(static_cast<char>(high + 1)), bytes));
+    }
+
+    uint32_t bitMask(Bytes bytes)
+    {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(bytes));
+    }
+#else
+    using Bytes = __m128i;
+    constexpr ptrdiff_t BLOCK_SIZE = 16;
+
+    Bytes loadBytes(const char* p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    Bytes splat(char c)
+    {
+        return _mm_set1_epi8(c);
+    }
+
+    Bytes equal(Bytes bytes, char c)
+    {
+        return _mm_cmpeq_epi8(bytes, splat(c));
+    }
+
+    Bytes either(Bytes a, Bytes b)
+    {
+        return _mm_or_si128(a, b);
+    }
+
+    // signed compares, so bytes of 0x80 and up are negative and never inside an ASCII range
+    Bytes inRange(Bytes bytes, char low, char high)
+    {
+        Bytes aboveLow = _mm_cmpgt_epi8(bytes, splat(static_cast<char>(low - 1)));
+        return _mm_and_si128(aboveLow, _mm_cmpgt_epi8(splat(static_cast<char>(high + 1)), bytes));
+    }
+
+    uint32_t bitMask(Bytes bytes)
+    {
+        return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+    }
+#endif
+
+    constexpr uint32_t FULL_MASK = static_cast<uint32_t>((uint64_t{1} << BLOCK_SIZE) - 1);
+
+    // Most runs are a space between tokens or a short name or number, over before a block would pay for itself, so
+    // the first few bytes are checked one at a time.
+    constexpr ptrdiff_t SHORT_RUN = 4;
+#endif
+
+    bool isIdentifierChar(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    bool isBlank(char c, int& line)
+    {
+        if (c == '\n')
+            line++;
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    // spaces, tabs, carriage returns and newlines, counting the newlines into `line`
+    const char* skipBlanks(const char* p, const char* end, int& line)
+    {
+#ifdef SIMD_SCANNER
+        for (const char* first = p; p < end && p - first < SHORT_RUN; p++)
+        {
+            if (!isBlank(*p, line))
+                return p;
+        }
+
+        for (; end - p >= BLOCK_SIZE; p += BLOCK_SIZE)
+        {
+            Bytes bytes = loadBytes(p);
+            uint32_t newlines = bitMask(equal(bytes, '\n'));
+            uint32_t blanks =
+                bitMask(either(either(equal(bytes, ' '), equal(bytes, '\t')), equal(bytes, '\r'))) | newlines;
+            if (blanks != FULL_MASK)
+            {
+                int length = std::countr_one(blanks);
+                line += std::popcount(newlines & ((1u << length) - 1));
+                return p + length;
+            }
+            line += std::popcount(newlines);
+        }
+#endif
+        while (p < end && isBlank(*p, line))
+            p++;
+        return p;
+    }
+
+    // up to, not past, the next newline
+    const char* skipLine(const char* p, const char* end)
+    {
+#ifdef SIMD_SCANNER
+        for (; end - p >= BLOCK_SIZE; p += BLOCK_SIZE)
+        {
+            uint32_t newlines = bitMask(equal(loadBytes(p), '\n'));
+            if (newlines != 0)
+                return p + std::countr_zero(newlines);
+        }
+#endif
+        while (p < end && *p != '\n')
+            p++;
+        return p;
+    }
+
+    const char* skipIdentifier(const char* p, const char* end)
+    {
+#ifdef SIMD_SCANNER
+        for (const char* first = p; p < end && p - first < SHORT_RUN; p++)
+        {
+            if (!isIdentifierChar(*p))
+                return p;
+        }
+
+        for (; end - p >= BLOCK_SIZE; p += BLOCK_SIZE)
+        {
+            Bytes bytes = loadBytes(p);
+            // 'A'-'Z' are the only bytes that | 0x20 turns into 'a'-'z'
+            Bytes letters = inRange(either(bytes, splat(0x20)), 'a', 'z');
+            uint32_t identifier = bitMask(either(either(letters, inRange(bytes, '0', '9')), equal(bytes, '_')));
+            if (identifier != FULL_MASK)
+                return p + std::countr_one(identifier);
+        }
+#endif
+        while (p < end && isIdentifierChar(*p))
+            p++;
+        return p;
+    }
+
+    const char* skipDigits(const char* p, const char* end)
+    {
+#ifdef SIMD_SCANNER
+        for (const char* first = p; p < end && p - first < SHORT_RUN; p++)
+        {
+            if (*p < '0' || *p > '9')
+                return p;
+        }
+
+        for (; end - p >= BLOCK_SIZE; p += BLOCK_SIZE)
+        {
+            uint32_t digits = bitMask(inRange(loadBytes(p), '0', '9'));
+            if (digits != FULL_MASK)
+                return p + std::countr_one(digits);
+        }
+#endif
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+        return p;
+    }
+} // namespace
+
 Token Scanner::scanToken()
 {
     skipWhitespace();
@@ -56,7 +255,7 @@ Token Scanner::scanToken()
 
 bool Scanner::isAtEnd()
 {
-    return m_current >= m_source.size();
+    return m_current >= m_end;
 }
 
 Token Scanner::makeToken(TokenType type)
@@ -64,25 +263,26 @@ Token Scanner::makeToken(TokenType type)
     if (type == TOKEN_EOF)
         return Token(type, "\0", 0, m_line);
 
-    return Token(type, &m_source.at(m_start), m_current - m_start, m_line);
+    return Token(type, m_start, static_cast<int>(m_current - m_start), m_line);
 }
 
-Token Scanner::errorToken(const std::string& message)
+// `message` must be a string literal, since the token keeps pointing at it
+Token Scanner::errorToken(const char* message)
 {
-    return Token(TOKEN_ERROR, message.c_str(), message.size(), m_line);
+    return Token(TOKEN_ERROR, message, static_cast<int>(std::strlen(message)), m_line);
 }
 
 char Scanner::advance()
 {
     m_current++;
-    return m_source[m_current - 1]; //! TODO book has m_current - 1??
+    return m_current[-1];
 }
 
 bool Scanner::match(char expected)
 {
     if (isAtEnd())
         return false;
-    if (m_source[m_current] != expected)
+    if (*m_current != expected)
         return false;
 
     m_current++;
@@ -93,44 +293,24 @@ void Scanner::skipWhitespace()
 {
     for (;;)
     {
-        char c = peek();
-        switch (c)
-        {
-        case ' ':
-        case '\r':
-        case '\t':
-            advance();
-            break;
-        case '\n':
-            m_line++;
-            advance();
-            break;
-        case '/':
-            if (peekNext() == '/')
-            {
-                while (peek() != '\n' && !isAtEnd())
-                    advance();
-            }
-            else
-            {
-                return;
-            }
-        default:
+        m_current = skipBlanks(m_current, m_end, m_line);
+        if (peek() != '/' || peekNext() != '/')
             return;
-        }
+
+        m_current = skipLine(m_current + 2, m_end); // a comment runs until the end of the line
     }
 }
 
 char Scanner::peek()
 {
-    return isAtEnd() ? '\0' : m_source[m_current];
+    return isAtEnd() ? '\0' : *m_current;
 }
 
 char Scanner::peekNext()
 {
-    if (isAtEnd())
+    if (m_end - m_current < 2)
         return '\0';
-    return m_source[m_current + 1];
+    return m_current[1];
 }
 bool Scanner::isAlpha(char c)
 {
@@ -160,30 +340,24 @@ Token Scanner::stringToken()
 
 Token Scanner::numberToken()
 {
-    while (isDigit(peek()))
-        advance();
+    m_current = skipDigits(m_current, m_end);
 
     if (peek() == '.' && isDigit(peekNext()))
-    {
-        advance(); // consume the .
-        while (isDigit(peek()))
-            advance();
-    }
+        m_current = skipDigits(m_current + 1, m_end); // past the .
 
     return makeToken(TOKEN_NUMBER);
 }
 
 Token Scanner::identifierToken()
 {
-    while (isAlpha(peek()) || isDigit(peek()))
-        advance();
+    m_current = skipIdentifier(m_current, m_end);
 
     return makeToken(identifierType());
 }
 
 TokenType Scanner::identifierType()
 {
-    switch (m_source[m_start])
+    switch (m_start[0])
     {
     case 'a':
         return checkKeyword(1, 2, "nd", TOKEN_AND);
@@ -194,7 +368,7 @@ TokenType Scanner::identifierType()
     case 'f':
         if (m_current - m_start > 1)
         {
-            switch (m_source[m_start + 1])
+            switch (m_start[1])
             {
             case 'a':
                 return checkKeyword(2, 3, "lse", TOKEN_FALSE);
@@ -220,7 +394,7 @@ TokenType Scanner::identifierType()
     case 't':
         if (m_current - m_start > 1)
         {
-            switch (m_source[m_start + 1])
+            switch (m_start[1])
             {
             case 'h':
                 return checkKeyword(2, 2, "is", TOKEN_THIS);
@@ -237,9 +411,9 @@ TokenType Scanner::identifierType()
     return TOKEN_IDENTIFIER;
 }
 
-TokenType Scanner::checkKeyword(int start, int length, const std::string& rest, TokenType type)
+TokenType Scanner::checkKeyword(int start, int length, const char* rest, TokenType type)
 {
-    if (m_current - m_start == start + length && m_source.compare(m_start + start, length, rest) == 0)
+    if (m_current - m_start == start + length && std::memcmp(m_start + start, rest, length) == 0)
     {
         return type;
     }
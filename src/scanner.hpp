@@ -1,6 +1,6 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
 enum TokenType
 {
@@ -70,33 +70,32 @@ class Scanner
   public:
     Scanner() = default;
 
-    Scanner(const std::string& source) : m_source(source)
+    // The scanner borrows `source`: it and the tokens point straight into the caller's buffer, which has to outlive
+    // them, and the buffer need not be null-terminated.
+    Scanner(std::string_view source)
     {
-        m_start = 0;
-        m_current = 0;
-        m_line = 1;
+        setSource(source);
     }
 
     Token scanToken();
 
-    void setSource(const std::string& source)
+    void setSource(std::string_view source)
     {
-        m_source = source;
-        m_start = 0;
-        m_current = 0;
+        m_start = source.data();
+        m_current = source.data();
+        m_end = source.data() + source.size();
         m_line = 1;
     }
 
   private:
-    std::string m_source;
-
-    size_t m_start;
-    size_t m_current;
-    int m_line;
+    const char* m_start = nullptr;
+    const char* m_current = nullptr;
+    const char* m_end = nullptr;
+    int m_line = 1;
 
     bool isAtEnd();
     Token makeToken(TokenType type);
-    Token errorToken(const std::string& message);
+    Token errorToken(const char* message);
     char advance();
     bool match(char expected);
     void skipWhitespace();
@@ -111,5 +110,5 @@ class Scanner
     Token identifierToken();
 
     TokenType identifierType();
-    TokenType checkKeyword(int start, int length, const std::string& rest, TokenType type);
+    TokenType checkKeyword(int start, int length, const char* rest, TokenType type);
 };
\ No newline at end of file
@@ -0,0 +1,626 @@
+#include "serializer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHUNK_FILE_MMAP
+#endif
+
+#include "vm.hpp"
+
+namespace
+{
+    constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+    enum ConstantTag : uint8_t
+    {
+        CONSTANT_NUMBER,
+        CONSTANT_STRING,
+        CONSTANT_FUNCTION,
+    };
+
+    // deepest function nesting a file may declare, so a hostile file cannot recurse the loader off the stack
+    constexpr int MAX_NESTING = 256;
+
+    void writeU32(std::string& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    void writeU64(std::string& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    void writeString(std::string& out, const std::string& str)
+    {
+        writeU32(out, static_cast<uint32_t>(str.size()));
+        out += str;
+    }
+
+    void writeChunk(std::string& out, const Chunk& chunk)
+    {
+        writeU32(out, static_cast<uint32_t>(chunk.constants.size()));
+        for (const Value& constant : chunk.constants)
+        {
+            if (constant.isString())
+            {
+                out.push_back(static_cast<char>(CONSTANT_STRING));
+                writeString(out, constant.asString()->str);
+            }
+            else if (constant.isObj() && constant.asObj()->isFunction())
+            {
+                const ObjFunction* function = static_cast<const ObjFunction*>(constant.asObj());
+                out.push_back(static_cast<char>(CONSTANT_FUNCTION));
+                writeString(out, function->name->str);
+                writeU32(out, static_cast<uint32_t>(function->arity));
+                writeU32(out, static_cast<uint32_t>(function->upvalues.size()));
+                for (const UpvalueCapture& capture : function->upvalues)
+                {
+                    out.push_back(static_cast<char>(capture.isLocal));
+                    writeU32(out, capture.index);
+                }
+                writeChunk(out, function->chunk);
+            }
+            else
+            {
+                out.push_back(static_cast<char>(CONSTANT_NUMBER));
+                writeU64(out, std::bit_cast<uint64_t>(constant.asNumber()));
+            }
+        }
+
+        writeU32(out, static_cast<uint32_t>(chunk.lines.size()));
+        for (const LineStart& run : chunk.lines)
+        {
+            writeU32(out, static_cast<uint32_t>(run.offset));
+            writeU32(out, static_cast<uint32_t>(run.line));
+        }
+
+        writeU32(out, static_cast<uint32_t>(chunk.code.size()));
+        out.append(reinterpret_cast<const char*>(chunk.code.data()), chunk.code.size());
+    }
+
+    // Bounds-checked cursor over the file; every read fails once the data runs out.
+    struct Reader
+    {
+        const uint8_t* data;
+        size_t size;
+        size_t position = 0;
+
+        bool bytes(size_t count, const uint8_t*& out)
+        {
+            if (count > size - position)
+                return false;
+
+            out = data + position;
+            position += count;
+            return true;
+        }
+
+        bool u8(uint8_t& out)
+        {
+            const uint8_t* p;
+            if (!bytes(1, p))
+                return false;
+
+            out = *p;
+            return true;
+        }
+
+        bool u32(uint32_t& out)
+        {
+            const uint8_t* p;
+            if (!bytes(4, p))
+                return false;
+
+            out = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                out |= static_cast<uint32_t>(p[i]) << (8 * i);
+            }
+            return true;
+        }
+
+        bool u64(uint64_t& out)
+        {
+            const uint8_t* p;
+            if (!bytes(8, p))
+                return false;
+
+            out = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                out |= static_cast<uint64_t>(p[i]) << (8 * i);
+            }
+            return true;
+        }
+
+        bool string(const char*& chars, uint32_t& length)
+        {
+            const uint8_t* p;
+            if (!u32(length) || !bytes(length, p))
+                return false;
+
+            chars = reinterpret_cast<const char*>(p);
+            return true;
+        }
+    };
+
+    // how many values the instruction at this offset reads off the top of the stack before pushing anything
+    int stackInputs(const uint8_t* code, size_t offset)
+    {
+        switch (code[offset])
+        {
+        case OP_POP:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_LONG:
+        case OP_DEFINE_GLOBAL_SLOT:
+        case OP_SET_GLOBAL_SLOT:
+        case OP_DEFINE_GLOBAL_SLOT_LONG:
+        case OP_SET_GLOBAL_SLOT_LONG:
+        case OP_SET_UPVALUE:
+        case OP_CLOSE_UPVALUE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_RETURN:
+            return 1;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_LESS:
+            return 2;
+        case OP_CALL:
+            return code[offset + 1] + 1;
+        default:
+            return 0;
+        }
+    }
+
+    uint32_t readOperand(const uint8_t* code, int width)
+    {
+        uint32_t operand = 0;
+        for (int i = 0; i < width; i++)
+        {
+            operand = (operand << 8) | code[i];
+        }
+        return operand;
+    }
+
+    // the function an OP_CLOSURE(_LONG) wraps, or nullptr if its operand names anything else
+    const ObjFunction* closureFunction(const Chunk& chunk, const uint8_t* code, size_t offset)
+    {
+        uint32_t constant = code[offset] == OP_CLOSURE_LONG ? readOperand(code + offset + 1, 3) : code[offset + 1];
+        if (constant >= chunk.constants.size())
+            return nullptr;
+
+        Value value = chunk.constants[constant];
+        if (!value.isObj() || !value.asObj()->isFunction())
+            return nullptr;
+
+        return static_cast<const ObjFunction*>(value.asObj());
+    }
+
+    // Code comes from outside the compiler, so before running it in place check everything the VM takes on trust:
+    // operands in range, jumps landing on instructions, and a stack that never underflows or disagrees with itself
+    // where paths meet.
+    bool verify(const Chunk& chunk, const uint8_t* code, size_t codeLength, size_t globalCount, size_t upvalueCount,
+                int entryDepth, size_t& maxStackDepth)
+    {
+        if (codeLength == 0 || chunk.lines.empty() || chunk.lines.front().offset != 0)
+            return false;
+
+        std::vector<bool> isStart(codeLength, false);
+        uint8_t last = OP_RETURN;
+        for (size_t offset = 0; offset < codeLength;)
+        {
+            uint8_t instruction = code[offset];
+            if (instruction > OP_RETURN || instructionLength(instruction) > codeLength - offset)
+                return false;
+
+            const uint8_t* operand = code + offset + 1;
+            switch (instruction)
+            {
+            case OP_CONSTANT:
+                if (operand[0] >= chunk.constants.size())
+                    return false;
+                break;
+            case OP_CONSTANT_LONG:
+                if (readOperand(operand, 3) >= chunk.constants.size())
+                    return false;
+                break;
+            case OP_LESS_LOCAL_CONST_JUMP:
+                if (operand[1] >= chunk.constants.size())
+                    return false;
+                break;
+            case OP_GET_GLOBAL_SLOT:
+            case OP_DEFINE_GLOBAL_SLOT:
+            case OP_SET_GLOBAL_SLOT:
+                if (operand[0] >= globalCount)
+                    return false;
+                break;
+            case OP_GET_GLOBAL_SLOT_LONG:
+            case OP_DEFINE_GLOBAL_SLOT_LONG:
+            case OP_SET_GLOBAL_SLOT_LONG:
+                if (readOperand(operand, 3) >= globalCount)
+                    return false;
+                break;
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE:
+                if (operand[0] >= upvalueCount)
+                    return false;
+                break;
+            case OP_CLOSURE:
+            case OP_CLOSURE_LONG: {
+                const ObjFunction* function = closureFunction(chunk, code, offset);
+                if (function == nullptr)
+                    return false;
+
+                for (const UpvalueCapture& capture : function->upvalues)
+                {
+                    if (!capture.isLocal && capture.index >= upvalueCount)
+                        return false;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+
+            isStart[offset] = true;
+            last = instruction;
+            offset += instructionLength(instruction);
+        }
+        // every path has to end in a return rather than run off the end of the mapping
+        if (last != OP_RETURN)
+            return false;
+
+        std::vector<int> depthAt(codeLength, -1);
+        std::vector<size_t> worklist = {0};
+        depthAt[0] = entryDepth;
+        int maxDepth = entryDepth;
+
+        auto reach = [&](size_t offset, int depth) {
+            if (offset >= codeLength || !isStart[offset])
+                return false;
+            if (depthAt[offset] == -1)
+            {
+                depthAt[offset] = depth;
+                worklist.push_back(offset);
+            }
+            return depthAt[offset] == depth;
+        };
+
+        while (!worklist.empty())
+        {
+            size_t offset = worklist.back();
+            worklist.pop_back();
+
+            uint8_t instruction = code[offset];
+            const uint8_t* operand = code + offset + 1;
+            int depth = depthAt[offset];
+            if (depth < stackInputs(code, offset))
+                return false;
+
+            // locals live below the values still on the stack
+            switch (instruction)
+            {
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_LESS_LOCAL_CONST_JUMP:
+                if (operand[0] >= depth)
+                    return false;
+                break;
+            case OP_GET_LOCAL_LONG:
+            case OP_SET_LOCAL_LONG:
+                if (readOperand(operand, 2) >= static_cast<uint32_t>(depth))
+                    return false;
+                break;
+            case OP_ADD_LOCALS:
+                if (operand[0] >= depth || operand[1] >= depth)
+                    return false;
+                break;
+            case OP_CLOSURE:
+            case OP_CLOSURE_LONG:
+                // a local function may capture itself, in the slot the closure is about to be pushed into
+                for (const UpvalueCapture& capture : closureFunction(chunk, code, offset)->upvalues)
+                {
+                    if (capture.isLocal && capture.index > depth)
+                        return false;
+                }
+                break;
+            default:
+                break;
+            }
+
+            depth += stackEffect(code, offset);
+            maxDepth = std::max(maxDepth, depth);
+
+            size_t next = offset + instructionLength(instruction);
+            if (isJump(instruction) && !reach(next + readJumpOffset(code, offset), depth))
+                return false;
+            if (instruction != OP_RETURN && instruction != OP_JUMP && !reach(next, depth))
+                return false;
+        }
+
+        maxStackDepth = static_cast<size_t>(maxDepth);
+        return true;
+    }
+
+    // Reads one chunk into `chunk`, recursing into the functions among its constants, and verifies its code,
+    // which is left in the file for the caller to run in place or copy.
+    bool readChunk(Reader& reader, VM& vm, Chunk& chunk, size_t globalCount, size_t upvalueCount, int entryDepth,
+                   int nesting, const uint8_t*& code, uint32_t& codeLength)
+    {
+        uint32_t constantCount = 0;
+        bool ok = reader.u32(constantCount);
+        for (uint32_t i = 0; ok && i < constantCount; i++)
+        {
+            uint8_t tag;
+            ok = reader.u8(tag);
+            if (ok && tag == CONSTANT_NUMBER)
+            {
+                uint64_t bits = 0;
+                ok = reader.u64(bits);
+                chunk.constants.push_back(Value(std::bit_cast<double>(bits)));
+            }
+            else if (ok && tag == CONSTANT_STRING)
+            {
+                const char* chars;
+                uint32_t length;
+                ok = reader.string(chars, length);
+                if (ok)
+                    chunk.constants.push_back(Value(vm.copyString(chars, length)));
+            }
+            else if (ok && tag == CONSTANT_FUNCTION && nesting < MAX_NESTING)
+            {
+                const char* chars;
+                uint32_t length;
+                uint32_t arity = 0;
+                uint32_t captureCount = 0;
+                ok = reader.string(chars, length) && reader.u32(arity) && arity <= UINT8_MAX &&
+                     reader.u32(captureCount) && captureCount <= UINT8_MAX + 1;
+
+                std::vector<UpvalueCapture> captures;
+                for (uint32_t j = 0; ok && j < captureCount; j++)
+                {
+                    uint8_t isLocal = 0;
+                    uint32_t index = 0;
+                    ok = reader.u8(isLocal) && isLocal <= 1 && reader.u32(index) && index <= UINT16_MAX;
+                    captures.push_back(UpvalueCapture{isLocal == 1, static_cast<uint16_t>(index)});
+                }
+                if (!ok)
+                    break;
+
+                // the function is rooted through this chunk's constants before anything of its own is interned
+                ObjString* name = vm.copyString(chars, length);
+                vm.push(Value(name));
+                ObjFunction* function = vm.allocateObject<ObjFunction>(name);
+                vm.pop();
+                function->arity = static_cast<int>(arity);
+                function->upvalues = std::move(captures);
+                chunk.constants.push_back(Value(function));
+
+                const uint8_t* functionCode = nullptr;
+                uint32_t functionLength = 0;
+                ok = readChunk(reader, vm, function->chunk, globalCount, function->upvalues.size(),
+                               function->arity + 1, nesting + 1, functionCode, functionLength);
+                if (ok)
+                    function->chunk.code.assign(functionCode, functionCode + functionLength);
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+
+        uint32_t lineCount = 0;
+        ok = ok && reader.u32(lineCount);
+        for (uint32_t i = 0; ok && i < lineCount; i++)
+        {
+            uint32_t offset = 0;
+            uint32_t line = 0;
+            ok = reader.u32(offset) && reader.u32(line);
+            chunk.lines.push_back(LineStart{offset, static_cast<int>(line)});
+        }
+
+        ok = ok && reader.u32(codeLength) && reader.bytes(codeLength, code);
+        return ok && verify(chunk, code, codeLength, globalCount, upvalueCount, entryDepth, chunk.maxStackDepth);
+    }
+} // namespace
+
+bool writeChunkFile(const Chunk& chunk, const std::vector<ObjString*>& globalNames, const std::string& path,
+                    const ChunkKey& key)
+{
+    std::string out(MAGIC, sizeof(MAGIC));
+    writeU32(out, CHUNK_FILE_VERSION);
+    writeU32(out, OP_RETURN + 1);
+
+    writeU64(out, key.sourceLength);
+    writeU64(out, key.sourceHash);
+    writeString(out, key.build);
+
+    writeU32(out, static_cast<uint32_t>(globalNames.size()));
+    for (ObjString* name : globalNames)
+    {
+        writeString(out, name->str);
+    }
+
+    writeChunk(out, chunk);
+
+    // written beside the target and renamed over it, so a reader never maps a half-written file
+    std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        if (!file.flush())
+        {
+            std::error_code error;
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    return true;
+}
+
+ChunkFile::ChunkFile(const std::string& path)
+{
+#ifdef CHUNK_FILE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<uint8_t*>(data);
+            m_size = static_cast<size_t>(info.st_size);
+            m_mapped = true;
+        }
+    }
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return;
+
+    m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (!m_buffer.empty())
+    {
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+#endif
+}
+
+ChunkFile::~ChunkFile()
+{
+#ifdef CHUNK_FILE_MMAP
+    if (m_mapped)
+        munmap(m_data, m_size);
+#endif
+}
+
+bool ChunkFile::readKey(ChunkKey& key) const
+{
+    Reader reader{m_data, m_size};
+    const uint8_t* magic;
+    uint32_t version;
+    uint32_t opcodeCount;
+    const char* build;
+    uint32_t buildLength;
+    if (!reader.bytes(sizeof(MAGIC), magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !reader.u32(version) || !reader.u32(opcodeCount) || version != CHUNK_FILE_VERSION ||
+        opcodeCount != OP_RETURN + 1 || !reader.u64(key.sourceLength) || !reader.u64(key.sourceHash) ||
+        !reader.string(build, buildLength))
+    {
+        return false;
+    }
+
+    key.build.assign(build, buildLength);
+    return true;
+}
+
+bool ChunkFile::load(VM& vm, Chunk& chunk)
+{
+    Reader reader{m_data, m_size};
+    const uint8_t* magic;
+    uint32_t version;
+    uint32_t opcodeCount;
+    if (!reader.bytes(sizeof(MAGIC), magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !reader.u32(version) || !reader.u32(opcodeCount))
+    {
+        m_error = "Not a compiled Lox file.";
+        return false;
+    }
+    if (version != CHUNK_FILE_VERSION || opcodeCount != OP_RETURN + 1)
+    {
+        m_error = "Compiled file is version " + std::to_string(version) + ", expected " +
+                  std::to_string(CHUNK_FILE_VERSION) + "; recompile it.";
+        return false;
+    }
+
+    // only the chunk cache cares which source and build the file came from
+    uint64_t sourceLength;
+    uint64_t sourceHash;
+    const char* build;
+    uint32_t buildLength;
+    if (!reader.u64(sourceLength) || !reader.u64(sourceHash) || !reader.string(build, buildLength))
+    {
+        m_error = "Compiled file is corrupt.";
+        return false;
+    }
+
+    uint32_t globalCount;
+    bool ok = reader.u32(globalCount);
+    for (uint32_t slot = 0; ok && slot < globalCount; slot++)
+    {
+        const char* chars;
+        uint32_t length;
+        ok = reader.string(chars, length);
+
+        // slot operands in the code are only right if every name lands on the slot it had when compiled
+        if (ok && vm.globalSlot(vm.copyString(chars, length)) != slot)
+        {
+            m_error = "Compiled file expects its globals to be defined first.";
+            return false;
+        }
+    }
+
+    const uint8_t* code = nullptr;
+    uint32_t codeLength = 0;
+    if (!ok || !readChunk(reader, vm, chunk, globalCount, 0, 0, 0, code, codeLength) || reader.position != m_size)
+    {
+        m_error = "Compiled file is corrupt.";
+        return false;
+    }
+
+    // the script's code is the last thing in the file and runs where it was mapped
+    m_code = m_data + (code - m_data);
+    m_codeLength = codeLength;
+    return true;
+}
+
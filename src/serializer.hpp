@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+#include "value.hpp"
+
+class VM;
+
+// Compiled chunks on disk (.loxc). All integers are little-endian:
+//
+//   "LOXC"  u32 version  u32 opcode count
+//   the ChunkKey:       u64 source length, u64 source hash, u32 length and bytes of the build identifier
+//   u32 global count,   per global:   u32 length, bytes             (name of each global slot, by slot)
+//   the script's chunk:
+//     u32 constant count, per constant: u8 tag, then a u64 double (tag 0), u32 length and bytes (tag 1), or
+//                                       for a function (tag 2) its name, u32 arity, u32 upvalue count, per
+//                                       upvalue u8 isLocal and u32 index, and then its own chunk
+//     u32 line run count, per run:      u32 offset, i32 line        (Chunk::lines)
+//     u32 code length,    code bytes                                (for the script, the rest of the file)
+//
+// Bump CHUNK_FILE_VERSION whenever the instruction set or the compiler's output changes meaning.
+constexpr uint32_t CHUNK_FILE_VERSION = 4;
+
+// What a chunk was compiled from and by, checked by the chunk cache before it runs an entry. Files written by
+// --compile are not tied to any source and leave the key empty.
+struct ChunkKey
+{
+    uint64_t sourceLength = 0;
+    uint64_t sourceHash = 0;
+    std::string build;
+
+    bool operator==(const ChunkKey&) const = default;
+};
+
+// Replaces the file at `path` atomically; returns false, leaving any previous file in place, on failure.
+bool writeChunkFile(const Chunk& chunk, const std::vector<ObjString*>& globalNames, const std::string& path,
+                    const ChunkKey& key = {});
+
+// A .loxc file mapped into memory. The script's code is executed in place from the mapping, which is private and
+// writable so that quickening only ever touches this process's copy of a page; function bodies are copied
+// into their ObjFunctions.
+class ChunkFile
+{
+  public:
+    explicit ChunkFile(const std::string& path);
+    ~ChunkFile();
+
+    ChunkFile(const ChunkFile&) = delete;
+    ChunkFile& operator=(const ChunkFile&) = delete;
+
+    bool isOpen() const
+    {
+        return m_data != nullptr;
+    }
+
+    // Checks the file and fills `chunk` with its constants and line table, interning strings and claiming the
+    // file's global slots in `vm`. Returns false, with the reason in error(), if the file cannot be run.
+    bool load(VM& vm, Chunk& chunk);
+
+    // Reads the header's key without loading anything; false if the file is not a current chunk file.
+    bool readKey(ChunkKey& key) const;
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+    uint8_t* code() const
+    {
+        return m_code;
+    }
+
+    size_t codeLength() const
+    {
+        return m_codeLength;
+    }
+
+  private:
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    uint8_t* m_code = nullptr;
+    size_t m_codeLength = 0;
+    bool m_mapped = false;
+    std::string m_error;
+    std::vector<uint8_t> m_buffer; // holds the file where it cannot be mapped
+};
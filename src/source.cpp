@@ -0,0 +1,110 @@
+#include "source.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOURCE_FILE_MMAP
+#endif
+
+namespace
+{
+    constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+
+#ifdef SOURCE_FILE_MMAP
+    bool readChunks(int fd, std::string& buffer)
+    {
+        size_t size = 0;
+        for (;;)
+        {
+            buffer.resize(size + READ_CHUNK_SIZE);
+            ssize_t count = read(fd, buffer.data() + size, READ_CHUNK_SIZE);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+            {
+                buffer.resize(size);
+                return count == 0;
+            }
+            size += static_cast<size_t>(count);
+        }
+    }
+#else
+    bool readChunks(std::istream& stream, std::string& buffer)
+    {
+        size_t size = 0;
+        while (stream)
+        {
+            buffer.resize(size + READ_CHUNK_SIZE);
+            stream.read(buffer.data() + size, READ_CHUNK_SIZE);
+            size += static_cast<size_t>(stream.gcount());
+        }
+        buffer.resize(size);
+        return stream.eof();
+    }
+#endif
+} // namespace
+
+SourceFile::SourceFile(const std::string& path)
+{
+#ifdef SOURCE_FILE_MMAP
+    bool isStdin = path == "-";
+    int fd = isStdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        size_t size = static_cast<size_t>(info.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            // the compiler reads the text once, front to back
+            madvise(data, size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+            m_size = size;
+            m_mapped = true;
+            m_open = true;
+        }
+    }
+
+    if (!m_mapped && readChunks(fd, m_buffer))
+    {
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        m_open = true;
+    }
+
+    if (!isStdin)
+        close(fd);
+#else
+    std::ifstream file;
+    if (path != "-")
+    {
+        file.open(path, std::ios::binary);
+        if (!file)
+            return;
+    }
+
+    if (readChunks(path == "-" ? std::cin : file, m_buffer))
+    {
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        m_open = true;
+    }
+#endif
+}
+
+SourceFile::~SourceFile()
+{
+#ifdef SOURCE_FILE_MMAP
+    if (m_mapped)
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
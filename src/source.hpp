@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// A script's text. Regular files are mapped read-only and handed to the compiler in place, so even a very large
+// script is never copied; anything that cannot be mapped (a pipe, a terminal, stdin given as "-") is read in
+// chunks into a buffer instead.
+class SourceFile
+{
+  public:
+    explicit SourceFile(const std::string& path);
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    bool isOpen() const
+    {
+        return m_open;
+    }
+
+    // valid for as long as the SourceFile is
+    std::string_view text() const
+    {
+        return std::string_view(m_data, m_size);
+    }
+
+  private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+    bool m_mapped = false;
+    std::string m_buffer; // holds the text where it cannot be mapped
+};
@@ -0,0 +1,204 @@
+#include "table.hpp"
+
+#include <cstring>
+
+#define TABLE_MAX_LOAD 0.75
+
+uint32_t hashString(const char* key, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<uint8_t>(key[i]);
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+bool Table::get(ObjString* key, Value& value) const
+{
+    if (m_count == 0)
+        return false;
+
+    const Entry& entry = m_entries[findEntry(m_entries, key)];
+    if (entry.key == nullptr)
+        return false;
+
+    value = entry.value;
+    return true;
+}
+
+bool Table::set(ObjString* key, Value value)
+{
+    if (m_count + 1 > m_entries.size() * TABLE_MAX_LOAD)
+    {
+        adjustCapacity(m_entries.empty() ? 8 : m_entries.size() * 2);
+    }
+
+    Entry& entry = m_entries[findEntry(m_entries, key)];
+    bool isNewKey = entry.key == nullptr;
+    if (isNewKey && !entry.isTombstone())
+        m_count++;
+
+    entry.key = key;
+    entry.value = value;
+    return isNewKey;
+}
+
+bool Table::remove(ObjString* key)
+{
+    if (m_count == 0)
+        return false;
+
+    Entry& entry = m_entries[findEntry(m_entries, key)];
+    if (entry.key == nullptr)
+        return false;
+
+    entry.key = nullptr;
+    entry.value = Value(true);
+    return true;
+}
+
+void Table::addAll(const Table& from)
+{
+    for (const Entry& entry : from.m_entries)
+    {
+        if (entry.key != nullptr)
+            set(entry.key, entry.value);
+    }
+}
+
+size_t Table::findEntry(const std::vector<Entry>& entries, ObjString* key)
+{
+    size_t mask = entries.size() - 1;
+    size_t tombstone = SIZE_MAX;
+
+    for (size_t index = key->hash & mask;; index = (index + 1) & mask)
+    {
+        const Entry& entry = entries[index];
+        if (entry.key == nullptr)
+        {
+            if (!entry.isTombstone())
+                return tombstone != SIZE_MAX ? tombstone : index;
+
+            if (tombstone == SIZE_MAX)
+                tombstone = index;
+        }
+        else if (entry.key == key)
+        {
+            return index;
+        }
+    }
+}
+
+void Table::adjustCapacity(size_t capacity)
+{
+    std::vector<Entry> entries(capacity);
+
+    // tombstones are dropped while rehashing
+    m_count = 0;
+    for (const Entry& entry : m_entries)
+    {
+        if (entry.key == nullptr)
+            continue;
+
+        Entry& dest = entries[findEntry(entries, entry.key)];
+        dest.key = entry.key;
+        dest.value = entry.value;
+        m_count++;
+    }
+
+    m_entries = std::move(entries);
+}
+
+ObjString* StringSet::find(const char* chars, size_t length, uint32_t hash) const
+{
+    if (m_entries.empty())
+        return nullptr;
+
+    size_t mask = m_entries.size() - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask)
+    {
+        const Entry& entry = m_entries[index];
+        if (entry.key == nullptr)
+        {
+            if (!entry.tombstone)
+                return nullptr;
+        }
+        else if (entry.key->hash == hash && entry.key->str.size() == length &&
+                 std::memcmp(entry.key->str.data(), chars, length) == 0)
+        {
+            return entry.key;
+        }
+    }
+}
+
+void StringSet::insert(ObjString* string)
+{
+    if (m_count + 1 > m_entries.size() * TABLE_MAX_LOAD)
+    {
+        adjustCapacity(m_entries.empty() ? 8 : m_entries.size() * 2);
+    }
+
+    Entry& entry = findEntry(m_entries, string);
+    if (entry.key == nullptr && !entry.tombstone)
+        m_count++;
+
+    entry.key = string;
+    entry.tombstone = false;
+}
+
+void StringSet::removeUnmarked()
+{
+    for (Entry& entry : m_entries)
+    {
+        if (entry.key != nullptr && !entry.key->isMarked)
+        {
+            entry.key = nullptr;
+            entry.tombstone = true;
+        }
+    }
+}
+
+StringSet::Entry& StringSet::findEntry(std::vector<Entry>& entries, ObjString* key)
+{
+    size_t mask = entries.size() - 1;
+    Entry* tombstone = nullptr;
+
+    for (size_t index = key->hash & mask;; index = (index + 1) & mask)
+    {
+        Entry& entry = entries[index];
+        if (entry.key == nullptr)
+        {
+            if (!entry.tombstone)
+                return tombstone != nullptr ? *tombstone : entry;
+
+            if (tombstone == nullptr)
+                tombstone = &entry;
+        }
+        else if (entry.key == key)
+        {
+            return entry;
+        }
+    }
+}
+
+void StringSet::adjustCapacity(size_t capacity)
+{
+    std::vector<Entry> entries(capacity);
+
+    // tombstones are dropped while rehashing
+    m_count = 0;
+    for (const Entry& entry : m_entries)
+    {
+        if (entry.key == nullptr)
+            continue;
+
+        findEntry(entries, entry.key).key = entry.key;
+        m_count++;
+    }
+
+    m_entries = std::move(entries);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "value.hpp"
+
+uint32_t hashString(const char* key, size_t length);
+
+// Open-addressing hash map from interned strings to values. Keys compare by pointer and probe from their
+// cached hash; capacity is always a power of two so the probe wraps with a mask.
+class Table
+{
+  public:
+    struct Entry
+    {
+        ObjString* key = nullptr;
+        Value value;
+
+        // a deleted slot has no key but a non-nil value, so probing continues past it
+        bool isTombstone() const
+        {
+            return key == nullptr && !value.isNil();
+        }
+    };
+
+    bool get(ObjString* key, Value& value) const;
+    // Returns true if the key was not already present.
+    bool set(ObjString* key, Value value);
+    bool remove(ObjString* key);
+    void addAll(const Table& from);
+
+    const std::vector<Entry>& entries() const
+    {
+        return m_entries;
+    }
+
+  private:
+    // live entries plus tombstones, so probe sequences always terminate
+    size_t m_count = 0;
+    std::vector<Entry> m_entries;
+
+    // Index of the key's slot, or of the slot it would be inserted into.
+    static size_t findEntry(const std::vector<Entry>& entries, ObjString* key);
+    void adjustCapacity(size_t capacity);
+};
+
+// Open-addressing set of interned strings. Entries are weak: the collector removes unmarked strings
+// before sweeping so the set never keeps a string alive on its own.
+class StringSet
+{
+  public:
+    ObjString* find(const char* chars, size_t length, uint32_t hash) const;
+    void insert(ObjString* string);
+    void removeUnmarked();
+
+  private:
+    struct Entry
+    {
+        ObjString* key = nullptr;
+        bool tombstone = false;
+    };
+
+    // live entries plus tombstones, so probe sequences always terminate
+    size_t m_count = 0;
+    std::vector<Entry> m_entries;
+
+    Entry& findEntry(std::vector<Entry>& entries, ObjString* key);
+    void adjustCapacity(size_t capacity);
+};
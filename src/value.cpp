@@ -2,22 +2,25 @@
 
 #include <iostream>
 
+#include "object.hpp"
+
 void printValue(Value value)
 {
-    switch (value.type)
+    if (value.isBool())
     {
-    case VAL_BOOL:
         std::cout << (value.asBool() ? "true" : "false");
-        break;
-    case VAL_NIL:
+    }
+    else if (value.isNil())
+    {
         std::cout << "nil";
-        break;
-    case VAL_OBJ:
-        printObject(value);
-        break;
-    case VAL_NUMBER:
+    }
+    else if (value.isNumber())
+    {
         std::cout << value.asNumber();
-        break;
+    }
+    else if (value.isObj())
+    {
+        printObject(value);
     }
 }
 
@@ -28,5 +31,17 @@ void printObject(Value value)
     case OBJ_STRING:
         std::cout << value.asString()->str;
         break;
+    case OBJ_FUNCTION:
+        std::cout << "<fn " << static_cast<ObjFunction*>(value.asObj())->name->str << ">";
+        break;
+    case OBJ_NATIVE:
+        std::cout << "<native fn>";
+        break;
+    case OBJ_CLOSURE:
+        std::cout << "<fn " << static_cast<ObjClosure*>(value.asObj())->function->name->str << ">";
+        break;
+    case OBJ_UPVALUE:
+        std::cout << "upvalue";
+        break;
     }
 }
\ No newline at end of file
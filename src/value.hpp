@@ -1,26 +1,34 @@
 #pragma once
 
-#include <memory>
+#include <bit>
+#include <cstdint>
 #include <string>
-#include <variant>
-#include <vector>
+
+#include "common.hpp"
 
 enum ValueType
 {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_UNDEFINED
 };
 
 enum ObjType
 {
     OBJ_STRING,
+    OBJ_FUNCTION,
+    OBJ_NATIVE,
+    OBJ_CLOSURE,
+    OBJ_UPVALUE,
 };
 
 struct Obj
 {
     ObjType type;
+    bool isMarked = false;
+    Obj* next = nullptr;
 
     virtual ~Obj() = default;
 
@@ -29,67 +37,189 @@ struct Obj
         return type == OBJ_STRING;
     }
 
+    bool isFunction() const
+    {
+        return type == OBJ_FUNCTION;
+    }
+
   protected:
     Obj(ObjType type) : type(type)
     {
     }
 };
 
+// Strings are interned by the VM, so two strings with the same contents are always the same object.
 struct ObjString : Obj
 {
     std::string str;
+    uint32_t hash;
+
+    ObjString(std::string str, uint32_t hash) : Obj(OBJ_STRING), str(std::move(str)), hash(hash)
+    {
+    }
+};
+
+#ifdef NAN_BOXING
+
+// A value is a single 64-bit word. Anything that is not a quiet NaN is a double; quiet NaNs carry
+// nil/true/false in their low bits, or an Obj pointer when the sign bit is also set.
+struct Value
+{
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+
+    static constexpr uint64_t TAG_NIL = 1;
+    static constexpr uint64_t TAG_FALSE = 2;
+    static constexpr uint64_t TAG_TRUE = 3;
+    static constexpr uint64_t TAG_UNDEFINED = 4;
+
+    static constexpr uint64_t NIL_VAL = QNAN | TAG_NIL;
+    static constexpr uint64_t FALSE_VAL = QNAN | TAG_FALSE;
+    static constexpr uint64_t TRUE_VAL = QNAN | TAG_TRUE;
+    static constexpr uint64_t UNDEFINED_VAL = QNAN | TAG_UNDEFINED;
+
+    uint64_t bits;
+
+    Value() : bits(NIL_VAL)
+    {
+    }
+
+    Value(bool value) : bits(value ? TRUE_VAL : FALSE_VAL)
+    {
+    }
+
+    Value(double value) : bits(std::bit_cast<uint64_t>(value))
+    {
+    }
+
+    Value(std::nullptr_t) : bits(NIL_VAL)
+    {
+    }
+
+    Value(Obj* value) : bits(SIGN_BIT | QNAN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)))
+    {
+    }
+
+    // Marks a global slot that has been referenced but not yet defined; never visible to scripts.
+    static Value undefined()
+    {
+        Value value;
+        value.bits = UNDEFINED_VAL;
+        return value;
+    }
+
+    bool isNil() const
+    {
+        return bits == NIL_VAL;
+    }
+    bool isUndefined() const
+    {
+        return bits == UNDEFINED_VAL;
+    }
+    bool isBool() const
+    {
+        return (bits | 1) == TRUE_VAL;
+    }
+    bool isNumber() const
+    {
+        return (bits & QNAN) != QNAN;
+    }
+    bool isObj() const
+    {
+        return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT);
+    }
+    bool isString() const
+    {
+        return isObj() && asObj()->isString();
+    }
 
-    ObjString() : str(), Obj(OBJ_STRING)
+    bool asBool() const
+    {
+        return bits == TRUE_VAL;
+    }
+    double asNumber() const
     {
+        return std::bit_cast<double>(bits);
+    }
+    Obj* asObj() const
+    {
+        return reinterpret_cast<Obj*>(static_cast<uintptr_t>(bits & ~(SIGN_BIT | QNAN)));
     }
 
-    ObjString(const char* str, int length) : Obj(OBJ_STRING), str(str, length)
+    ObjString* asString() const
     {
+        return static_cast<ObjString*>(asObj());
     }
 
-    ObjString(const std::string& str) : Obj(OBJ_STRING), str(str)
+    bool operator==(const Value& other) const
     {
+        // compare as doubles so NaN != NaN, matching the tagged representation
+        if (isNumber() && other.isNumber())
+        {
+            return asNumber() == other.asNumber();
+        }
+
+        return bits == other.bits;
     }
 };
+
+#else
+
 struct Value
 {
     ValueType type;
-    std::variant<std::monostate, bool, double, std::shared_ptr<Obj>> as;
+    union {
+        bool boolean;
+        double number;
+        Obj* obj;
+    } as;
 
-    Value() : type(VAL_NIL), as(std::monostate{})
+    Value() : type(VAL_NIL), as{.number = 0}
     {
     }
 
-    Value(bool value) : type(VAL_BOOL), as(value)
+    Value(bool value) : type(VAL_BOOL), as{.boolean = value}
     {
     }
-    Value(double value) : type(VAL_NUMBER), as(value)
+    Value(double value) : type(VAL_NUMBER), as{.number = value}
     {
     }
 
-    Value(std::nullptr_t) : type(VAL_NIL), as(std::monostate{})
+    Value(std::nullptr_t) : type(VAL_NIL), as{.number = 0}
     {
     }
 
-    Value(std::shared_ptr<Obj> value) : type(VAL_OBJ), as(value)
+    Value(Obj* value) : type(VAL_OBJ), as{.obj = value}
     {
     }
 
+    // Marks a global slot that has been referenced but not yet defined; never visible to scripts.
+    static Value undefined()
+    {
+        Value value;
+        value.type = VAL_UNDEFINED;
+        return value;
+    }
+
     bool isNil() const
     {
-        return std::holds_alternative<std::monostate>(as);
+        return type == VAL_NIL;
+    }
+    bool isUndefined() const
+    {
+        return type == VAL_UNDEFINED;
     }
     bool isBool() const
     {
-        return std::holds_alternative<bool>(as);
+        return type == VAL_BOOL;
     }
     bool isNumber() const
     {
-        return std::holds_alternative<double>(as);
+        return type == VAL_NUMBER;
     }
     bool isObj() const
     {
-        return std::holds_alternative<std::shared_ptr<Obj>>(as);
+        return type == VAL_OBJ;
     }
     bool isString() const
     {
@@ -98,20 +228,20 @@ struct Value
 
     bool asBool() const
     {
-        return std::get<bool>(as);
+        return as.boolean;
     }
     double asNumber() const
     {
-        return std::get<double>(as);
+        return as.number;
     }
-    std::shared_ptr<Obj> asObj() const
+    Obj* asObj() const
     {
-        return std::get<std::shared_ptr<Obj>>(as);
+        return as.obj;
     }
 
-    std::shared_ptr<ObjString> asString() const
+    ObjString* asString() const
     {
-        return std::dynamic_pointer_cast<ObjString>(asObj());
+        return static_cast<ObjString*>(asObj());
     }
 
     bool operator==(const Value& other) const
@@ -121,14 +251,29 @@ struct Value
             return false;
         }
 
-        if (isString() && other.isString())
+        switch (type)
         {
-            return asString()->str == other.asString()->str;
+        case VAL_BOOL:
+            return asBool() == other.asBool();
+        case VAL_NIL:
+        case VAL_UNDEFINED:
+            return true;
+        case VAL_NUMBER:
+            return asNumber() == other.asNumber();
+        case VAL_OBJ:
+            return asObj() == other.asObj();
         }
 
-        return as == other.as;
+        return false;
     }
 };
 
+#endif
+
+inline bool isFalsey(Value value)
+{
+    return value.isNil() || (value.isBool() && !value.asBool());
+}
+
 void printValue(Value value);
-void printObject(Value value);
\ No newline at end of file
+void printObject(Value value);
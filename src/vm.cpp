@@ -1,198 +1,1359 @@
 #include "vm.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 #include "common.hpp"
 #include "compiler.hpp"
 #include "debug.hpp"
+#include "registers.hpp"
 
-InterpretResult VM::interpret(Chunk* chunk)
+static Value clockNative(int, Value*)
+{
+    auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+    return Value(std::chrono::duration<double>(elapsed).count());
+}
+
+VM::VM()
+{
+    defineNative("clock", clockNative);
+}
+
+void VM::defineNative(const char* name, NativeFn function)
+{
+    // the name is rooted by the global slot table before the native is allocated
+    size_t slot = globalSlot(copyString(name, std::strlen(name)));
+    ObjNative* native = allocateObject<ObjNative>(function);
+    m_globalValues[slot] = Value(native);
+}
+
+void VM::pushClosure(ObjFunction* function, ObjClosure* enclosing, Value* slots)
 {
+    ObjClosure* closure = allocateObject<ObjClosure>(function);
+    // on the stack before capturing, since capturing allocates
+    push(Value(closure));
+    for (size_t i = 0; i < function->upvalues.size(); i++)
+    {
+        const UpvalueCapture& capture = function->upvalues[i];
+        closure->upvalues[i] = capture.isLocal ? captureUpvalue(slots + capture.index)
+                                               : enclosing->upvalues[capture.index];
+    }
+}
+
+ObjUpvalue* VM::captureUpvalue(Value* local)
+{
+    ObjUpvalue* previous = nullptr;
+    ObjUpvalue* upvalue = m_openUpvalues;
+    while (upvalue != nullptr && upvalue->location > local)
+    {
+        previous = upvalue;
+        upvalue = upvalue->nextUpvalue;
+    }
+
+    if (upvalue != nullptr && upvalue->location == local)
+        return upvalue;
+
+    ObjUpvalue* created = allocateObject<ObjUpvalue>(local);
+    created->nextUpvalue = upvalue;
+    if (previous == nullptr)
+        m_openUpvalues = created;
+    else
+        previous->nextUpvalue = created;
+
+    return created;
+}
+
+void VM::closeUpvalues(Value* last)
+{
+    while (m_openUpvalues != nullptr && m_openUpvalues->location >= last)
+    {
+        ObjUpvalue* upvalue = m_openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        m_openUpvalues = upvalue->nextUpvalue;
+    }
+}
+
+void VM::enterScript(Chunk* chunk, uint8_t* code)
+{
+    m_frames[0] = CallFrame{nullptr, chunk, code, code, m_stack};
+    m_frameCount = 1;
     m_currentChunk = chunk;
-    m_instructionPointer = m_currentChunk->code.data();
+    m_code = m_instructionPointer = code;
+}
+
+InterpretResult VM::interpret(Chunk* chunk)
+{
+    chunk->maxStackDepth = computeMaxStackDepth(*chunk);
+
+    m_ranRegisterCode = false;
+    if (m_registerMode)
+    {
+        Chunk registerChunk;
+        if (lowerToRegisters(*chunk, registerChunk))
+        {
+            m_ranRegisterCode = true;
+            enterScript(&registerChunk, registerChunk.code.data());
+
+            InterpretResult result = runRegisters();
+
+            m_currentChunk = nullptr;
+            return result;
+        }
+
+        std::cerr << "Register code needs operands wider than a byte here; running the stack code instead."
+                  << std::endl;
+    }
+
+    enterScript(chunk, chunk->code.data());
+
+    InterpretResult result = run();
 
-    return run();
+    m_currentChunk = nullptr;
+    return result;
 }
 
-InterpretResult VM::interpret(const std::string& source)
+bool VM::compile(std::string_view source, Chunk& chunk)
+{
+    Compiler compiler(*this, m_optimizationLevel);
+
+    // the chunk is a GC root while the compiler is still filling its constant pool
+    m_currentChunk = &chunk;
+    bool compiled = compiler.compile(source, &chunk);
+    m_currentChunk = nullptr;
+
+    return compiled;
+}
+
+InterpretResult VM::interpret(std::string_view source)
 {
     Chunk chunk;
-    Compiler compiler(*this);
+    if (!compile(source, chunk))
+        return INTERPRET_COMPILE_ERROR;
 
-    if (!compiler.compile(source, &chunk))
+    return interpret(&chunk);
+}
+
+InterpretResult VM::interpret(ChunkFile& file)
+{
+    Chunk chunk;
+
+    // as when compiling, the constants are rooted through the chunk while the file's strings are interned
+    m_currentChunk = &chunk;
+    if (!file.load(*this, chunk))
     {
+        m_currentChunk = nullptr;
         return INTERPRET_COMPILE_ERROR;
     }
 
-    m_currentChunk = &chunk;
-    m_instructionPointer = m_currentChunk->code.data();
+    // register code is lowered from a copy; otherwise the code runs straight from the mapping and `chunk` only
+    // carries the constants and line table
+    if (m_registerMode)
+    {
+        chunk.code.assign(file.code(), file.code() + file.codeLength());
+        return interpret(&chunk);
+    }
+
+    enterScript(&chunk, file.code());
 
     InterpretResult result = run();
 
+    m_currentChunk = nullptr;
     return result;
 }
 
+// an instruction's `width`-byte big-endian operand
+static inline uint32_t readBigEndian(const uint8_t* operand, int width)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < width; i++)
+        value = (value << 8) | operand[i];
+    return value;
+}
+
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic push
+#ifdef __clang__
+#pragma GCC diagnostic ignored "-Wgnu-label-as-value"
+#else
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+#endif
+
 InterpretResult VM::run()
 {
+    // the only overflow check: a chunk never grows the stack past the depth the compiler computed for it
+    if (m_stackTop + m_currentChunk->maxStackDepth > m_stack + STACK_MAX)
+    {
+        std::cout << "Stack overflow." << std::endl;
+        resetStack();
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    Value* stackTop = m_stackTop;
+    // locals and upvalues of the running frame
+    Value* slots = m_frames[m_frameCount - 1].slots;
+    ObjClosure* closure = m_frames[m_frameCount - 1].closure;
+
 #define READ_BYTE() (*m_instructionPointer++)
-#define READ_SHORT() (m_instructionPointer += 2, (uint16_t)((m_instructionPointer[-2] << 8) | m_instructionPointer[-1]))
+#define READ_SHORT() (m_instructionPointer += 2, static_cast<uint16_t>(readBigEndian(m_instructionPointer - 2, 2)))
+#define READ_UINT24() (m_instructionPointer += 3, readBigEndian(m_instructionPointer - 3, 3))
+#define READ_UINT32() (m_instructionPointer += 4, readBigEndian(m_instructionPointer - 4, 4))
 #define READ_CONSTANT() (m_currentChunk->constants[READ_BYTE()])
+#define READ_CONSTANT_LONG() (m_currentChunk->constants[READ_UINT24()])
+#define PUSH(value) (*stackTop++ = (value))
+#define POP() (*--stackTop)
+#define PEEK(distance) (stackTop[-1 - (distance)])
+#define STORE_STACK() (m_stackTop = stackTop)
+#define LOAD_STACK() (stackTop = m_stackTop)
 #define BINARY_OP(op)                                   \
     do                                                  \
     {                                                   \
-        if (!peek(0).isNumber() || !peek(1).isNumber()) \
+        if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) \
+        {                                               \
+            runtimeError("Operands must be numbers.");  \
+            return INTERPRET_RUNTIME_ERROR;             \
+        }                                               \
+        double b = POP().asNumber();                    \
+        double a = POP().asNumber();                    \
+        PUSH(Value(a op b));                            \
+    } while (false)
+// pops two numbers and takes the jump that follows when `condition` holds for them
+#define COMPARE_JUMP(condition)                         \
+    do                                                  \
+    {                                                   \
+        uint32_t offset = READ_UINT32();                \
+        if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) \
         {                                               \
             runtimeError("Operands must be numbers.");  \
             return INTERPRET_RUNTIME_ERROR;             \
         }                                               \
-        double b = pop().asNumber();                    \
-        double a = pop().asNumber();                    \
-        push(Value(a op b));                            \
+        double b = POP().asNumber();                    \
+        double a = POP().asNumber();                    \
+        if (condition)                                  \
+        {                                               \
+            m_instructionPointer += offset;             \
+        }                                               \
     } while (false)
 
-    for (;;)
-    {
 #ifdef DEBUG_TRACE_EXECUTION
-        printStack();
-        disassembleInstruction(*m_currentChunk, (int)(m_instructionPointer - m_currentChunk->code.data()));
+#define TRACE_INSTRUCTION()                                                                                 \
+    do                                                                                                      \
+    {                                                                                                       \
+        STORE_STACK();                                                                                      \
+        printStack();                                                                                       \
+        disassembleInstruction(*m_currentChunk, m_code, (size_t)(m_instructionPointer - m_code));           \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE())
-        {
-        case OP_CONSTANT: {
-            Value constant = READ_CONSTANT();
-            push(constant);
-            std::cout << std::endl;
-            break;
-        }
-        case OP_NIL:
-            push(Value(nullptr));
-            break;
-        case OP_TRUE:
-            push(Value(true));
-            break;
-        case OP_FALSE:
-            push(Value(false));
-            break;
-        case OP_POP:
-            pop();
-            break;
-        case OP_GET_LOCAL: {
-            uint8_t slot = READ_BYTE();
-            push(m_stack[slot]);
-            break;
-        }
-        case OP_SET_LOCAL: {
-            uint8_t slot = READ_BYTE();
-            m_stack[slot] = peek(0);
-            break;
-        }
-        case OP_GET_GLOBAL: {
-            std::shared_ptr<ObjString> name = READ_CONSTANT().asString();
-            Value value;
-            try
+
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() m_opcodeProfile.record(*m_instructionPointer)
+#else
+#define PROFILE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef COMPUTED_GOTO
+    // one entry per OpCode, in declaration order
+    static void* dispatchTable[] = {
+        &&L_OP_CONSTANT,
+        &&L_OP_CONSTANT_LONG,
+        &&L_OP_NIL,
+        &&L_OP_TRUE,
+        &&L_OP_FALSE,
+        &&L_OP_POP,
+        &&L_OP_GET_LOCAL,
+        &&L_OP_SET_LOCAL,
+        &&L_OP_GET_LOCAL_LONG,
+        &&L_OP_SET_LOCAL_LONG,
+        &&L_OP_GET_GLOBAL_SLOT,
+        &&L_OP_DEFINE_GLOBAL_SLOT,
+        &&L_OP_SET_GLOBAL_SLOT,
+        &&L_OP_GET_GLOBAL_SLOT_LONG,
+        &&L_OP_DEFINE_GLOBAL_SLOT_LONG,
+        &&L_OP_SET_GLOBAL_SLOT_LONG,
+        &&L_OP_GET_UPVALUE,
+        &&L_OP_SET_UPVALUE,
+        &&L_OP_EQUAL,
+        &&L_OP_GREATER,
+        &&L_OP_LESS,
+        &&L_OP_NOT_EQUAL,
+        &&L_OP_GREATER_EQUAL,
+        &&L_OP_LESS_EQUAL,
+        &&L_OP_ADD,
+        &&L_OP_ADD_NUM,
+        &&L_OP_ADD_STR,
+        &&L_OP_SUBTRACT,
+        &&L_OP_MULTIPLY,
+        &&L_OP_DIVIDE,
+        &&L_OP_NOT,
+        &&L_OP_NEGATE,
+        &&L_OP_PRINT,
+        &&L_OP_JUMP,
+        &&L_OP_JUMP_IF_FALSE,
+        &&L_OP_POP_JUMP_IF_FALSE,
+        &&L_OP_JUMP_IF_NOT_EQUAL,
+        &&L_OP_JUMP_IF_EQUAL,
+        &&L_OP_JUMP_IF_NOT_GREATER,
+        &&L_OP_JUMP_IF_NOT_LESS,
+        &&L_OP_JUMP_IF_GREATER,
+        &&L_OP_JUMP_IF_LESS,
+        &&L_OP_ADD_LOCALS,
+        &&L_OP_LESS_LOCAL_CONST_JUMP,
+        &&L_OP_CLOSURE,
+        &&L_OP_CLOSURE_LONG,
+        &&L_OP_CLOSE_UPVALUE,
+        &&L_OP_CALL,
+        &&L_OP_RETURN,
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OP_RETURN + 1);
+
+#define DISPATCH()                        \
+    do                                    \
+    {                                     \
+        TRACE_INSTRUCTION();              \
+        PROFILE_INSTRUCTION();            \
+        goto* dispatchTable[READ_BYTE()]; \
+    } while (false)
+#define INTERPRET_START DISPATCH();
+#define INTERPRET_END
+#define CASE(op) L_##op:
+#define NEXT DISPATCH()
+#else
+#define INTERPRET_START        \
+    for (;;)                   \
+    {                          \
+        TRACE_INSTRUCTION();   \
+        PROFILE_INSTRUCTION(); \
+        switch (READ_BYTE())   \
+        {
+#define INTERPRET_END \
+    }                 \
+    }
+#define CASE(op) case op:
+#define NEXT break
+#endif
+
+    INTERPRET_START
+
+    CASE(OP_CONSTANT)
+    {
+        PUSH(READ_CONSTANT());
+        NEXT;
+    }
+    CASE(OP_CONSTANT_LONG)
+    {
+        PUSH(READ_CONSTANT_LONG());
+        NEXT;
+    }
+    CASE(OP_NIL)
+    {
+        PUSH(Value(nullptr));
+        NEXT;
+    }
+    CASE(OP_TRUE)
+    {
+        PUSH(Value(true));
+        NEXT;
+    }
+    CASE(OP_FALSE)
+    {
+        PUSH(Value(false));
+        NEXT;
+    }
+    CASE(OP_POP)
+    {
+        stackTop--;
+        NEXT;
+    }
+    CASE(OP_GET_LOCAL)
+    {
+        uint8_t slot = READ_BYTE();
+        PUSH(slots[slot]);
+        NEXT;
+    }
+    CASE(OP_SET_LOCAL)
+    {
+        uint8_t slot = READ_BYTE();
+        slots[slot] = PEEK(0);
+        NEXT;
+    }
+    CASE(OP_GET_LOCAL_LONG)
+    {
+        uint16_t slot = READ_SHORT();
+        PUSH(slots[slot]);
+        NEXT;
+    }
+    CASE(OP_SET_LOCAL_LONG)
+    {
+        uint16_t slot = READ_SHORT();
+        slots[slot] = PEEK(0);
+        NEXT;
+    }
+    CASE(OP_GET_GLOBAL_SLOT)
+    {
+        uint8_t slot = READ_BYTE();
+        Value value = m_globalValues[slot];
+        if (value.isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        PUSH(value);
+        NEXT;
+    }
+    CASE(OP_DEFINE_GLOBAL_SLOT)
+    {
+        uint8_t slot = READ_BYTE();
+        m_globalValues[slot] = POP();
+        NEXT;
+    }
+    CASE(OP_SET_GLOBAL_SLOT)
+    {
+        uint8_t slot = READ_BYTE();
+        if (m_globalValues[slot].isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        m_globalValues[slot] = PEEK(0);
+        NEXT;
+    }
+    CASE(OP_GET_GLOBAL_SLOT_LONG)
+    {
+        uint32_t slot = READ_UINT24();
+        Value value = m_globalValues[slot];
+        if (value.isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        PUSH(value);
+        NEXT;
+    }
+    CASE(OP_DEFINE_GLOBAL_SLOT_LONG)
+    {
+        uint32_t slot = READ_UINT24();
+        m_globalValues[slot] = POP();
+        NEXT;
+    }
+    CASE(OP_SET_GLOBAL_SLOT_LONG)
+    {
+        uint32_t slot = READ_UINT24();
+        if (m_globalValues[slot].isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        m_globalValues[slot] = PEEK(0);
+        NEXT;
+    }
+    CASE(OP_GET_UPVALUE)
+    {
+        uint8_t slot = READ_BYTE();
+        PUSH(*closure->upvalues[slot]->location);
+        NEXT;
+    }
+    CASE(OP_SET_UPVALUE)
+    {
+        uint8_t slot = READ_BYTE();
+        *closure->upvalues[slot]->location = PEEK(0);
+        NEXT;
+    }
+    CASE(OP_EQUAL)
+    {
+        Value b = POP();
+        Value a = POP();
+        PUSH(Value(a == b));
+        NEXT;
+    }
+    CASE(OP_GREATER)
+    {
+        BINARY_OP(>);
+        NEXT;
+    }
+    CASE(OP_LESS)
+    {
+        BINARY_OP(<);
+        NEXT;
+    }
+    CASE(OP_NOT_EQUAL)
+    {
+        Value b = POP();
+        Value a = POP();
+        PUSH(Value(!(a == b)));
+        NEXT;
+    }
+    CASE(OP_GREATER_EQUAL)
+    {
+        // negated rather than >= so NaN compares exactly as the unfused OP_LESS, OP_NOT did
+        BINARY_OP(<);
+        PEEK(0) = Value(!PEEK(0).asBool());
+        NEXT;
+    }
+    CASE(OP_LESS_EQUAL)
+    {
+        BINARY_OP(>);
+        PEEK(0) = Value(!PEEK(0).asBool());
+        NEXT;
+    }
+    CASE(OP_ADD)
+    {
+        // quicken: specialize this instruction in place for the operand types it sees, so later runs skip the
+        // type dispatch below
+        if (PEEK(0).isString() && PEEK(1).isString())
+        {
+            m_instructionPointer[-1] = OP_ADD_STR;
+            STORE_STACK();
+            concactenate();
+            LOAD_STACK();
+        }
+        else if (PEEK(0).isNumber() && PEEK(1).isNumber())
+        {
+            m_instructionPointer[-1] = OP_ADD_NUM;
+            double b = POP().asNumber();
+            PEEK(0) = Value(PEEK(0).asNumber() + b);
+        }
+        else
+        {
+            runtimeError("Operands must be two numbers or two strings.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        NEXT;
+    }
+    CASE(OP_ADD_NUM)
+    {
+        if (!PEEK(0).isNumber() || !PEEK(1).isNumber())
+        {
+            // types changed: fall back to the generic instruction and run it instead
+            m_instructionPointer[-1] = OP_ADD;
+            m_instructionPointer--;
+            NEXT;
+        }
+        double b = POP().asNumber();
+        PEEK(0) = Value(PEEK(0).asNumber() + b);
+        NEXT;
+    }
+    CASE(OP_ADD_STR)
+    {
+        if (!PEEK(0).isString() || !PEEK(1).isString())
+        {
+            m_instructionPointer[-1] = OP_ADD;
+            m_instructionPointer--;
+            NEXT;
+        }
+        STORE_STACK();
+        concactenate();
+        LOAD_STACK();
+        NEXT;
+    }
+    CASE(OP_SUBTRACT)
+    {
+        BINARY_OP(-);
+        NEXT;
+    }
+    CASE(OP_MULTIPLY)
+    {
+        BINARY_OP(*);
+        NEXT;
+    }
+    CASE(OP_DIVIDE)
+    {
+        BINARY_OP(/);
+        NEXT;
+    }
+    CASE(OP_NOT)
+    {
+        PEEK(0) = Value(isFalsey(PEEK(0)));
+        NEXT;
+    }
+    CASE(OP_NEGATE)
+    {
+        if (!PEEK(0).isNumber())
+        {
+            runtimeError("Operand must be a number.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        PEEK(0) = Value(-PEEK(0).asNumber());
+        NEXT;
+    }
+    CASE(OP_PRINT)
+    {
+        printValue(POP());
+        std::cout << std::endl;
+        NEXT;
+    }
+    CASE(OP_JUMP)
+    {
+        uint32_t offset = READ_UINT32();
+        m_instructionPointer += offset;
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_FALSE)
+    {
+        uint32_t offset = READ_UINT32();
+        if (isFalsey(PEEK(0)))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(OP_POP_JUMP_IF_FALSE)
+    {
+        uint32_t offset = READ_UINT32();
+        if (isFalsey(POP()))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_NOT_EQUAL)
+    {
+        uint32_t offset = READ_UINT32();
+        Value b = POP();
+        Value a = POP();
+        if (!(a == b))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_EQUAL)
+    {
+        uint32_t offset = READ_UINT32();
+        Value b = POP();
+        Value a = POP();
+        if (a == b)
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_NOT_GREATER)
+    {
+        COMPARE_JUMP(!(a > b));
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_NOT_LESS)
+    {
+        COMPARE_JUMP(!(a < b));
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_GREATER)
+    {
+        COMPARE_JUMP(a > b);
+        NEXT;
+    }
+    CASE(OP_JUMP_IF_LESS)
+    {
+        COMPARE_JUMP(a < b);
+        NEXT;
+    }
+    CASE(OP_ADD_LOCALS)
+    {
+        Value a = slots[READ_BYTE()];
+        Value b = slots[READ_BYTE()];
+        if (a.isNumber() && b.isNumber())
+        {
+            PUSH(Value(a.asNumber() + b.asNumber()));
+        }
+        else if (a.isString() && b.isString())
+        {
+            // both operands sit in the frame's slots, which keep them alive while the result is allocated, so
+            // nothing is pushed beyond the +1 that stackEffect gives this instruction
+            STORE_STACK();
+            ObjString* result = takeString(a.asString()->str + b.asString()->str);
+            PUSH(Value(result));
+        }
+        else
+        {
+            runtimeError("Operands must be two numbers or two strings.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        NEXT;
+    }
+    CASE(OP_LESS_LOCAL_CONST_JUMP)
+    {
+        Value a = slots[READ_BYTE()];
+        Value b = READ_CONSTANT();
+        uint32_t offset = READ_UINT32();
+        if (!a.isNumber() || !b.isNumber())
+        {
+            runtimeError("Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        if (!(a.asNumber() < b.asNumber()))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(OP_CALL)
+    {
+        int argCount = READ_BYTE();
+        Value callee = PEEK(argCount);
+        if (callee.isObj() && callee.asObj()->type == OBJ_CLOSURE)
+        {
+            ObjClosure* calleeClosure = static_cast<ObjClosure*>(callee.asObj());
+            ObjFunction* function = calleeClosure->function;
+            if (argCount != function->arity)
             {
-                value = m_globals[name->str];
+                runtimeError("Expected {} arguments but got {}.", function->arity, argCount);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            catch (std::out_of_range)
+
+            // as on entry to run(), the callee's whole stack is checked once here rather than on every push
+            Value* base = stackTop - argCount - 1;
+            if (m_frameCount == FRAMES_MAX || base + function->chunk.maxStackDepth > m_stack + STACK_MAX)
             {
-                runtimeError("Undefined variable '%s'.", name->str.c_str());
+                runtimeError("Stack overflow.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
-            push(value);
-            break;
+            m_frames[m_frameCount - 1].ip = m_instructionPointer;
+            uint8_t* code = function->chunk.code.data();
+            m_frames[m_frameCount++] = CallFrame{calleeClosure, &function->chunk, code, code, base};
+            m_currentChunk = &function->chunk;
+            m_code = m_instructionPointer = code;
+            slots = base;
+            closure = calleeClosure;
         }
-        case OP_DEFINE_GLOBAL: {
-            std::shared_ptr<ObjString> name = READ_CONSTANT().asString();
-            m_globals[name->str] = peek(0);
-            pop();
-            break;
+        else if (callee.isObj() && callee.asObj()->type == OBJ_NATIVE)
+        {
+            NativeFn native = static_cast<ObjNative*>(callee.asObj())->function;
+            STORE_STACK();
+            Value result = native(argCount, stackTop - argCount);
+            stackTop -= argCount + 1;
+            PUSH(result);
         }
-        case OP_SET_GLOBAL: {
-            std::shared_ptr<ObjString> name = READ_CONSTANT().asString();
-            if (m_globals.find(name->str) == m_globals.end())
-            {
-                runtimeError("Undefined variable '%s'.", name->str.c_str());
-                return INTERPRET_RUNTIME_ERROR;
-            }
+        else
+        {
+            runtimeError("Can only call functions and classes.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        NEXT;
+    }
+    CASE(OP_CLOSURE)
+    {
+        ObjFunction* function = static_cast<ObjFunction*>(READ_CONSTANT().asObj());
+        STORE_STACK();
+        pushClosure(function, closure, slots);
+        LOAD_STACK();
+        NEXT;
+    }
+    CASE(OP_CLOSURE_LONG)
+    {
+        ObjFunction* function = static_cast<ObjFunction*>(READ_CONSTANT_LONG().asObj());
+        STORE_STACK();
+        pushClosure(function, closure, slots);
+        LOAD_STACK();
+        NEXT;
+    }
+    CASE(OP_CLOSE_UPVALUE)
+    {
+        closeUpvalues(stackTop - 1);
+        stackTop--;
+        NEXT;
+    }
+    CASE(OP_RETURN)
+    {
+        Value result = POP();
+        // the frame's locals are about to be overwritten, so any closure still holding one takes its own copy
+        closeUpvalues(slots);
+        stackTop = slots;
+        if (--m_frameCount == 0)
+        {
+            STORE_STACK();
+            return INTERPRET_OK;
+        }
+
+        PUSH(result);
+        const CallFrame& frame = m_frames[m_frameCount - 1];
+        m_currentChunk = frame.chunk;
+        m_code = frame.code;
+        m_instructionPointer = frame.ip;
+        slots = frame.slots;
+        closure = frame.closure;
+        NEXT;
+    }
+
+    INTERPRET_END
 
-            m_globals[name->str] = peek(0);
-            break;
+    return INTERPRET_RUNTIME_ERROR;
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_UINT24
+#undef READ_UINT32
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_STACK
+#undef LOAD_STACK
+#undef BINARY_OP
+#undef COMPARE_JUMP
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+#undef DISPATCH
+#undef INTERPRET_START
+#undef INTERPRET_END
+#undef CASE
+#undef NEXT
+}
+
+InterpretResult VM::runRegisters()
+{
+    // registers are the frame's stack slots; two more above them are scratch for concactenate
+    if (m_stack + m_currentChunk->maxStackDepth + 2 > m_stack + STACK_MAX)
+    {
+        std::cout << "Stack overflow." << std::endl;
+        resetStack();
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    Value* registers = m_stack;
+    ObjClosure* closure = nullptr;
+    for (size_t i = 0; i < m_currentChunk->maxStackDepth; i++)
+    {
+        registers[i] = Value(nullptr);
+    }
+    // the whole register file stays visible to the collector while the chunk runs. Calls only ever raise
+    // m_stackTop: a caller's dead registers above a callee's are read again only after being written, but
+    // they must not hold objects the collector freed while they were out of its sight
+    m_stackTop = registers + m_currentChunk->maxStackDepth;
+
+#define READ_BYTE() (*m_instructionPointer++)
+#define READ_UINT32()                                                                                    \
+    (m_instructionPointer += 4, ((uint32_t)m_instructionPointer[-4] << 24) |                                  \
+                                    ((uint32_t)m_instructionPointer[-3] << 16) |                              \
+                                    ((uint32_t)m_instructionPointer[-2] << 8) | (uint32_t)m_instructionPointer[-1])
+#define R(index) (registers[index])
+#define BINARY_OP(op)                                  \
+    do                                                 \
+    {                                                  \
+        uint8_t a = READ_BYTE();                       \
+        Value b = R(READ_BYTE());                      \
+        Value c = R(READ_BYTE());                      \
+        if (!b.isNumber() || !c.isNumber())            \
+        {                                              \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR;            \
+        }                                              \
+        R(a) = Value(b.asNumber() op c.asNumber());    \
+    } while (false)
+#define COMPARE_JUMP(condition)                        \
+    do                                                 \
+    {                                                  \
+        Value b = R(READ_BYTE());                      \
+        Value c = R(READ_BYTE());                      \
+        uint32_t offset = READ_UINT32();               \
+        if (!b.isNumber() || !c.isNumber())            \
+        {                                              \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR;            \
+        }                                              \
+        if (condition)                                 \
+        {                                              \
+            m_instructionPointer += offset;            \
+        }                                              \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                                                                \
+    do                                                                                     \
+    {                                                                                      \
+        size_t offset = (size_t)(m_instructionPointer - m_code);                          \
+        printStack();                                                                      \
+        disassembleRegisterInstruction(*m_currentChunk, offset);                           \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() m_opcodeProfile.instructions++
+#else
+#define PROFILE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef COMPUTED_GOTO
+    // one entry per RegisterOpCode, in declaration order
+    static void* dispatchTable[] = {
+        &&L_REG_MOVE,
+        &&L_REG_LOAD_CONSTANT,
+        &&L_REG_LOAD_NIL,
+        &&L_REG_LOAD_TRUE,
+        &&L_REG_LOAD_FALSE,
+        &&L_REG_GET_GLOBAL,
+        &&L_REG_DEFINE_GLOBAL,
+        &&L_REG_SET_GLOBAL,
+        &&L_REG_EQUAL,
+        &&L_REG_NOT_EQUAL,
+        &&L_REG_GREATER,
+        &&L_REG_GREATER_EQUAL,
+        &&L_REG_LESS,
+        &&L_REG_LESS_EQUAL,
+        &&L_REG_ADD,
+        &&L_REG_SUBTRACT,
+        &&L_REG_MULTIPLY,
+        &&L_REG_DIVIDE,
+        &&L_REG_NOT,
+        &&L_REG_NEGATE,
+        &&L_REG_PRINT,
+        &&L_REG_JUMP,
+        &&L_REG_JUMP_IF_FALSE,
+        &&L_REG_JUMP_IF_NOT_EQUAL,
+        &&L_REG_JUMP_IF_EQUAL,
+        &&L_REG_JUMP_IF_NOT_GREATER,
+        &&L_REG_JUMP_IF_NOT_LESS,
+        &&L_REG_JUMP_IF_GREATER,
+        &&L_REG_JUMP_IF_LESS,
+        &&L_REG_GET_UPVALUE,
+        &&L_REG_SET_UPVALUE,
+        &&L_REG_CLOSURE,
+        &&L_REG_CLOSE_UPVALUE,
+        &&L_REG_CALL,
+        &&L_REG_RETURN,
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == REG_RETURN + 1);
+
+#define DISPATCH()                        \
+    do                                    \
+    {                                     \
+        TRACE_INSTRUCTION();              \
+        PROFILE_INSTRUCTION();            \
+        goto* dispatchTable[READ_BYTE()]; \
+    } while (false)
+#define INTERPRET_START DISPATCH();
+#define INTERPRET_END
+#define CASE(op) L_##op:
+#define NEXT DISPATCH()
+#else
+#define INTERPRET_START        \
+    for (;;)                   \
+    {                          \
+        TRACE_INSTRUCTION();   \
+        PROFILE_INSTRUCTION(); \
+        switch (READ_BYTE())   \
+        {
+#define INTERPRET_END \
+    }                 \
+    }
+#define CASE(op) case op:
+#define NEXT break
+#endif
+
+    INTERPRET_START
+
+    CASE(REG_MOVE)
+    {
+        uint8_t a = READ_BYTE();
+        R(a) = R(READ_BYTE());
+        NEXT;
+    }
+    CASE(REG_LOAD_CONSTANT)
+    {
+        uint8_t a = READ_BYTE();
+        R(a) = m_currentChunk->constants[READ_BYTE()];
+        NEXT;
+    }
+    CASE(REG_LOAD_NIL)
+    {
+        R(READ_BYTE()) = Value(nullptr);
+        NEXT;
+    }
+    CASE(REG_LOAD_TRUE)
+    {
+        R(READ_BYTE()) = Value(true);
+        NEXT;
+    }
+    CASE(REG_LOAD_FALSE)
+    {
+        R(READ_BYTE()) = Value(false);
+        NEXT;
+    }
+    CASE(REG_GET_GLOBAL)
+    {
+        uint8_t a = READ_BYTE();
+        uint8_t slot = READ_BYTE();
+        Value value = m_globalValues[slot];
+        if (value.isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
         }
-        case OP_EQUAL: {
-            Value b = pop();
-            Value a = pop();
-            push(Value(a == b));
-            break;
+
+        R(a) = value;
+        NEXT;
+    }
+    CASE(REG_DEFINE_GLOBAL)
+    {
+        uint8_t slot = READ_BYTE();
+        m_globalValues[slot] = R(READ_BYTE());
+        NEXT;
+    }
+    CASE(REG_SET_GLOBAL)
+    {
+        uint8_t slot = READ_BYTE();
+        Value value = R(READ_BYTE());
+        if (m_globalValues[slot].isUndefined())
+        {
+            runtimeError("Undefined variable '{}'.", m_globalNames[slot]->str);
+            return INTERPRET_RUNTIME_ERROR;
         }
-        case OP_ADD:
-            if (peek(0).isString() && peek(1).isString())
-            {
-                concactenate();
-            }
-            else if (peek(0).isNumber() && peek(1).isNumber())
+
+        m_globalValues[slot] = value;
+        NEXT;
+    }
+    CASE(REG_EQUAL)
+    {
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        R(a) = Value(b == c);
+        NEXT;
+    }
+    CASE(REG_NOT_EQUAL)
+    {
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        R(a) = Value(!(b == c));
+        NEXT;
+    }
+    CASE(REG_GREATER)
+    {
+        BINARY_OP(>);
+        NEXT;
+    }
+    CASE(REG_GREATER_EQUAL)
+    {
+        // !(b < c), so comparisons with NaN agree with the stack VM
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        if (!b.isNumber() || !c.isNumber())
+        {
+            runtimeError("Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        R(a) = Value(!(b.asNumber() < c.asNumber()));
+        NEXT;
+    }
+    CASE(REG_LESS)
+    {
+        BINARY_OP(<);
+        NEXT;
+    }
+    CASE(REG_LESS_EQUAL)
+    {
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        if (!b.isNumber() || !c.isNumber())
+        {
+            runtimeError("Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        R(a) = Value(!(b.asNumber() > c.asNumber()));
+        NEXT;
+    }
+    CASE(REG_ADD)
+    {
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        if (b.isNumber() && c.isNumber())
+        {
+            R(a) = Value(b.asNumber() + c.asNumber());
+        }
+        else if (b.isString() && c.isString())
+        {
+            push(b);
+            push(c);
+            concactenate();
+            R(a) = pop();
+        }
+        else
+        {
+            runtimeError("Operands must be two numbers or two strings.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        NEXT;
+    }
+    CASE(REG_SUBTRACT)
+    {
+        BINARY_OP(-);
+        NEXT;
+    }
+    CASE(REG_MULTIPLY)
+    {
+        BINARY_OP(*);
+        NEXT;
+    }
+    CASE(REG_DIVIDE)
+    {
+        BINARY_OP(/);
+        NEXT;
+    }
+    CASE(REG_NOT)
+    {
+        uint8_t a = READ_BYTE();
+        R(a) = Value(isFalsey(R(READ_BYTE())));
+        NEXT;
+    }
+    CASE(REG_NEGATE)
+    {
+        uint8_t a = READ_BYTE();
+        Value b = R(READ_BYTE());
+        if (!b.isNumber())
+        {
+            runtimeError("Operand must be a number.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        R(a) = Value(-b.asNumber());
+        NEXT;
+    }
+    CASE(REG_PRINT)
+    {
+        printValue(R(READ_BYTE()));
+        std::cout << std::endl;
+        NEXT;
+    }
+    CASE(REG_JUMP)
+    {
+        uint32_t offset = READ_UINT32();
+        m_instructionPointer += offset;
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_FALSE)
+    {
+        Value condition = R(READ_BYTE());
+        uint32_t offset = READ_UINT32();
+        if (isFalsey(condition))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_NOT_EQUAL)
+    {
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        uint32_t offset = READ_UINT32();
+        if (!(b == c))
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_EQUAL)
+    {
+        Value b = R(READ_BYTE());
+        Value c = R(READ_BYTE());
+        uint32_t offset = READ_UINT32();
+        if (b == c)
+        {
+            m_instructionPointer += offset;
+        }
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_NOT_GREATER)
+    {
+        COMPARE_JUMP(!(b.asNumber() > c.asNumber()));
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_NOT_LESS)
+    {
+        COMPARE_JUMP(!(b.asNumber() < c.asNumber()));
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_GREATER)
+    {
+        COMPARE_JUMP(b.asNumber() > c.asNumber());
+        NEXT;
+    }
+    CASE(REG_JUMP_IF_LESS)
+    {
+        COMPARE_JUMP(b.asNumber() < c.asNumber());
+        NEXT;
+    }
+    CASE(REG_GET_UPVALUE)
+    {
+        uint8_t a = READ_BYTE();
+        R(a) = *closure->upvalues[READ_BYTE()]->location;
+        NEXT;
+    }
+    CASE(REG_SET_UPVALUE)
+    {
+        uint8_t u = READ_BYTE();
+        *closure->upvalues[u]->location = R(READ_BYTE());
+        NEXT;
+    }
+    CASE(REG_CLOSURE)
+    {
+        uint8_t a = READ_BYTE();
+        ObjFunction* function = static_cast<ObjFunction*>(m_currentChunk->constants[READ_BYTE()].asObj());
+        // built on the scratch space above the registers, which keeps it reachable while it captures
+        pushClosure(function, closure, registers);
+        R(a) = pop();
+        NEXT;
+    }
+    CASE(REG_CLOSE_UPVALUE)
+    {
+        closeUpvalues(&R(READ_BYTE()));
+        NEXT;
+    }
+    CASE(REG_CALL)
+    {
+        uint8_t a = READ_BYTE();
+        int argCount = READ_BYTE();
+        Value callee = R(a);
+        if (callee.isObj() && callee.asObj()->type == OBJ_CLOSURE)
+        {
+            ObjClosure* calleeClosure = static_cast<ObjClosure*>(callee.asObj());
+            ObjFunction* function = calleeClosure->function;
+            if (argCount != function->arity)
             {
-                BINARY_OP(+);
+                runtimeError("Expected {} arguments but got {}.", function->arity, argCount);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            else
+
+            Chunk* chunk = &function->registerChunk;
+            if (chunk->code.empty() && !lowerFunctionToRegisters(function))
             {
-                runtimeError("Operands must be two numbers or two strings.");
+                runtimeError("Function {}() needs operands wider than a byte and cannot run as register code.",
+                             function->name->str);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
-        case OP_SUBTRACT:
-            BINARY_OP(-);
-            break;
-        case OP_MULTIPLY:
-            BINARY_OP(*);
-            break;
-        case OP_DIVIDE:
-            BINARY_OP(/);
-            break;
-        case OP_NOT:
-            push(Value(isFalsey(pop())));
-            break;
-        case OP_NEGATE:
-            if (!peek(0).isNumber())
+
+            Value* base = &R(a);
+            if (m_frameCount == FRAMES_MAX || base + chunk->maxStackDepth + 2 > m_stack + STACK_MAX)
             {
-                runtimeError("Operand must be a number.");
+                runtimeError("Stack overflow.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            push(-pop().asNumber());
-            break;
-        case OP_PRINT: {
-            printValue(pop());
-            std::cout << std::endl;
-        }
-        case OP_JUMP: {
-            uint16_t offset = READ_SHORT();
-            m_instructionPointer += offset;
-            break;
-        }
-        case OP_JUMP_IF_FALSE: {
-            uint16_t offset = READ_SHORT();
-            if (isFalsey(peek(0)))
+
+            for (Value* slot = base + argCount + 1; slot < base + chunk->maxStackDepth; slot++)
             {
-                m_instructionPointer += offset;
+                *slot = Value(nullptr);
             }
-            break;
+            m_stackTop = std::max(m_stackTop, base + chunk->maxStackDepth);
+
+            m_frames[m_frameCount - 1].ip = m_instructionPointer;
+            m_frames[m_frameCount++] = CallFrame{calleeClosure, chunk, chunk->code.data(), chunk->code.data(), base};
+            m_currentChunk = chunk;
+            m_code = m_instructionPointer = chunk->code.data();
+            registers = base;
+            closure = calleeClosure;
         }
-        case OP_RETURN:
+        else if (callee.isObj() && callee.asObj()->type == OBJ_NATIVE)
+        {
+            NativeFn native = static_cast<ObjNative*>(callee.asObj())->function;
+            R(a) = native(argCount, &R(a + 1));
+        }
+        else
+        {
+            runtimeError("Can only call functions and classes.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        NEXT;
+    }
+    CASE(REG_RETURN)
+    {
+        Value result = R(READ_BYTE());
+        // as in run(), closures still holding one of the frame's registers take their own copy
+        closeUpvalues(registers);
+        if (--m_frameCount == 0)
+        {
+            resetStack();
             return INTERPRET_OK;
         }
+
+        registers[0] = result;
+        const CallFrame& frame = m_frames[m_frameCount - 1];
+        m_currentChunk = frame.chunk;
+        m_code = frame.code;
+        m_instructionPointer = frame.ip;
+        registers = frame.slots;
+        closure = frame.closure;
+        NEXT;
     }
 
+    INTERPRET_END
+
+    return INTERPRET_RUNTIME_ERROR;
+
 #undef READ_BYTE
-#undef READ_SHORT
-#undef READ_CONSTANT
+#undef READ_UINT32
+#undef R
 #undef BINARY_OP
+#undef COMPARE_JUMP
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+#undef DISPATCH
+#undef INTERPRET_START
+#undef INTERPRET_END
+#undef CASE
+#undef NEXT
+}
+
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+size_t VM::globalSlot(ObjString* name)
+{
+    Value slot;
+    if (m_globalSlots.get(name, slot))
+        return static_cast<size_t>(slot.asNumber());
+
+    m_globalValues.push_back(Value::undefined());
+    m_globalNames.push_back(name);
+    m_globalSlots.set(name, Value(static_cast<double>(m_globalValues.size() - 1)));
+    return m_globalValues.size() - 1;
+}
+
+ObjString* VM::copyString(const char* chars, size_t length)
+{
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = m_strings.find(chars, length, hash);
+    if (interned != nullptr)
+        return interned;
+
+    ObjString* string = allocateObject<ObjString>(std::string(chars, length), hash);
+    m_strings.insert(string);
+    return string;
+}
+
+ObjString* VM::takeString(std::string&& str)
+{
+    uint32_t hash = hashString(str.data(), str.size());
+    ObjString* interned = m_strings.find(str.data(), str.size(), hash);
+    if (interned != nullptr)
+        return interned;
+
+    ObjString* string = allocateObject<ObjString>(std::move(str), hash);
+    m_strings.insert(string);
+    return string;
 }
 
 void VM::printStack()
 {
     std::cout << "          ";
 
-    for (const Value& value : m_stack)
+    for (Value* slot = m_stack; slot < m_stackTop; slot++)
     {
+        const Value& value = *slot;
         std::cout << "[ ";
         printValue(value);
         std::cout << " ]";
@@ -201,23 +1362,15 @@ void VM::printStack()
     std::cout << std::endl;
 }
 
-Value VM::peek(int distance)
-{
-    return m_stack[m_stack.size() - 1 - distance];
-}
-
-bool VM::isFalsey(const Value& value)
-{
-    return value.isNil() || (value.isBool() && !value.asBool());
-}
-
 void VM::concactenate()
 {
-    std::shared_ptr<ObjString> b = pop().asString();
-    std::shared_ptr<ObjString> a = pop().asString();
+    ObjString* b = peek(0).asString();
+    ObjString* a = peek(1).asString();
 
-    std::string result = a->str + b->str;
-    m_objects.push_back(std::make_shared<ObjString>(result));
+    // operands stay on the stack until the result exists so a collection cannot free them
+    ObjString* result = takeString(a->str + b->str);
+    pop();
+    pop();
 
-    push(Value(m_objects.back()));
+    push(Value(result));
 }
\ No newline at end of file
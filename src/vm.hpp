@@ -3,10 +3,14 @@
 #include <format>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "chunk.hpp"
+#include "object.hpp"
+#include "serializer.hpp"
+#include "table.hpp"
 #include "value.hpp"
 
 enum InterpretResult
@@ -16,51 +20,183 @@ enum InterpretResult
     INTERPRET_RUNTIME_ERROR,
 };
 
+#ifdef PROFILE_OPCODES
+// Counts of consecutively dispatched opcode pairs and triples, keyed by the opcodes packed into the low bytes
+// (oldest first). Used by tools/OpcodeStats to pick superinstruction candidates.
+struct OpcodeProfile
+{
+    std::unordered_map<uint32_t, uint64_t> bigrams;
+    std::unordered_map<uint32_t, uint64_t> trigrams;
+    // every instruction dispatched, in either execution mode; n-grams are only kept for stack bytecode
+    uint64_t instructions = 0;
+    uint32_t history = 0;
+    int seen = 0;
+
+    void record(uint8_t instruction)
+    {
+        instructions++;
+        history = ((history << 8) | instruction) & 0xffffff;
+        seen++;
+        if (seen >= 2)
+            bigrams[history & 0xffff]++;
+        if (seen >= 3)
+            trigrams[history]++;
+    }
+};
+#endif
+
+// One active call. The frames live in a fixed array in the VM, so a call allocates nothing.
+struct CallFrame
+{
+    ObjClosure* closure; // nullptr for the top-level script
+    Chunk* chunk;
+    uint8_t* code; // chunk->code, or a mapped .loxc file for the script
+    uint8_t* ip;   // where the caller resumes; the running frame's ip lives in m_instructionPointer
+    Value* slots;  // first stack slot of the frame: the callee, then its arguments and locals
+};
+
 class VM
 {
   public:
-    VM() = default;
+    VM();
+    ~VM()
+    {
+        freeVM();
+    }
 
-    InterpretResult interpret(const std::string& source);
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    InterpretResult interpret(std::string_view source);
     InterpretResult interpret(Chunk* chunk);
+    InterpretResult interpret(ChunkFile& file);
 
-    void push(Value value)
+    // Compiles without running, e.g. to write the chunk out with writeChunkFile.
+    bool compile(std::string_view source, Chunk& chunk);
+
+    // names of the global slots handed out so far, indexed by slot
+    const std::vector<ObjString*>& globalNames() const
     {
-        m_stack.push_back(value);
+        return m_globalNames;
     }
 
-    Value pop()
+    // peephole level applied to everything compiled from source from now on (see optimizeChunk)
+    void setOptimizationLevel(int level)
+    {
+        m_optimizationLevel = level;
+    }
+
+    int optimizationLevel() const
     {
-        Value value = m_stack.back();
-        m_stack.pop_back();
-        return value;
+        return m_optimizationLevel;
     }
 
-    void insertObject(std::shared_ptr<Obj> object)
+    // run scripts compiled from source as register code (see registers.hpp) instead of stack bytecode
+    void setRegisterMode(bool enabled)
     {
-        m_objects.push_back(object);
+        m_registerMode = enabled;
     }
 
-    std::shared_ptr<Obj> getObject(size_t index)
+    // whether the last script interpreted ran as register code; in register mode a chunk that cannot be
+    // lowered runs as stack code instead, with a notice on stderr
+    bool ranRegisterCode() const
     {
-        return m_objects[index];
+        return m_ranRegisterCode;
     }
 
-    std::shared_ptr<Obj> getLastObject()
+#ifdef PROFILE_OPCODES
+    const OpcodeProfile& opcodeProfile() const
     {
-        return m_objects.back();
+        return m_opcodeProfile;
     }
+#endif
+
+    static constexpr int FRAMES_MAX = 64;
+    static constexpr size_t STACK_MAX = FRAMES_MAX * (UINT8_MAX + 1);
+
+    void push(Value value)
+    {
+        *m_stackTop++ = value;
+    }
+
+    Value pop()
+    {
+        return *--m_stackTop;
+    }
+
+    // Allocates a heap object owned by the VM, collecting first if the heap has outgrown its threshold.
+    template <typename T, typename... Args>
+    T* allocateObject(Args&&... args)
+    {
+#ifdef DEBUG_STRESS_GC
+        collectGarbage();
+#else
+        if (m_bytesAllocated > m_nextGC)
+        {
+            collectGarbage();
+        }
+#endif
+
+        T* object = new T(std::forward<Args>(args)...);
+        object->next = m_objects;
+        m_objects = object;
+        m_bytesAllocated += objectSize(object);
+
+#ifdef DEBUG_LOG_GC
+        std::cout << static_cast<void*>(object) << " allocate " << objectSize(object) << " for " << object->type
+                  << std::endl;
+#endif
+
+        return object;
+    }
+
+    // Returns the interned string with these contents, allocating it if it does not exist yet.
+    ObjString* copyString(const char* chars, size_t length);
+    ObjString* takeString(std::string&& str);
+
+    // Index of the global slot for this name, creating an undefined slot on first use.
+    size_t globalSlot(ObjString* name);
+
+    void collectGarbage();
 
   private:
-    std::vector<Value> m_stack;
-    std::vector<std::shared_ptr<Obj>> m_objects;
-    std::unordered_map<std::string, Value> m_globals;
-    Chunk* m_currentChunk;
-    uint8_t* m_instructionPointer;
+    Value m_stack[STACK_MAX];
+    // run() keeps its own copy of the top in a local and writes it back before anything that can look at the
+    // stack (allocation, errors, tracing)
+    Value* m_stackTop = m_stack;
+    Obj* m_objects = nullptr;
+    StringSet m_strings;
+    std::vector<Obj*> m_grayStack;
+    size_t m_bytesAllocated = 0;
+    size_t m_nextGC = 1024 * 1024;
+    // Globals are resolved to slots at compile time; m_globalSlots maps each name to its index so a
+    // later script (or REPL line) referring to the same name shares the slot.
+    std::vector<Value> m_globalValues;
+    std::vector<ObjString*> m_globalNames;
+    Table m_globalSlots;
+    int m_optimizationLevel = 0;
+    bool m_registerMode = false;
+    bool m_ranRegisterCode = false;
+    CallFrame m_frames[FRAMES_MAX];
+    int m_frameCount = 0;
+    // upvalues still pointing into the stack, sorted from the highest slot down
+    ObjUpvalue* m_openUpvalues = nullptr;
+    // chunk of the running frame, or of the script while it is compiled or loaded
+    Chunk* m_currentChunk = nullptr;
+    // start of the code being run: m_currentChunk->code, or a mapped .loxc file
+    uint8_t* m_code = nullptr;
+    uint8_t* m_instructionPointer = nullptr;
+#ifdef PROFILE_OPCODES
+    OpcodeProfile m_opcodeProfile;
+#endif
 
     InterpretResult run();
+    InterpretResult runRegisters();
 
-    Value peek(int distance);
+    Value peek(int distance) const
+    {
+        return m_stackTop[-1 - distance];
+    }
 
     template <typename... Args>
     void runtimeError(const std::string& format, Args&&... args)
@@ -69,23 +205,51 @@ class VM
 
         std::cout << message << std::endl;
 
-        size_t instruction = m_instructionPointer - m_currentChunk->code.data() - 1;
-        int line = m_currentChunk->lines[instruction];
-        std::cout << "[line " << line << "] in script" << std::endl;
+        m_frames[m_frameCount - 1].ip = m_instructionPointer;
+        for (int i = m_frameCount - 1; i >= 0; i--)
+        {
+            const CallFrame& frame = m_frames[i];
+            size_t instruction = frame.ip - frame.code - 1;
+            std::cout << "[line " << frame.chunk->getLine(instruction) << "] in ";
+            if (frame.closure == nullptr)
+                std::cout << "script" << std::endl;
+            else
+                std::cout << frame.closure->function->name->str << "()" << std::endl;
+        }
         resetStack();
     }
 
     void resetStack()
     {
-        m_stack.clear();
+        m_stackTop = m_stack;
+        m_frameCount = 0;
+        m_openUpvalues = nullptr;
     }
 
+    // Pushes the frame for the top-level script, whose slots start at the bottom of the stack.
+    void enterScript(Chunk* chunk, uint8_t* code);
+    void defineNative(const char* name, NativeFn function);
+
+    // Pushes a new closure over `function`, capturing from the frame whose closure and slots are given.
+    void pushClosure(ObjFunction* function, ObjClosure* enclosing, Value* slots);
+    // Returns the open upvalue for this stack slot, creating it if no closure has captured the slot yet.
+    ObjUpvalue* captureUpvalue(Value* local);
+    // Moves every variable at or above `last` off the stack into the upvalues that captured it.
+    void closeUpvalues(Value* last);
+
     void printStack();
-    bool isFalsey(const Value& value);
 
     void concactenate();
-    void freeVM()
-    {
-        m_objects.clear();
-    }
+
+    static size_t objectSize(Obj* object);
+    void markRoots();
+    void markValue(Value value);
+    void markObject(Obj* object);
+    void markChunk(const Chunk& chunk);
+    void markTable(const Table& table);
+    void traceReferences();
+    void blackenObject(Obj* object);
+    void sweep();
+    void freeObject(Obj* object);
+    void freeVM();
 };
\ No newline at end of file
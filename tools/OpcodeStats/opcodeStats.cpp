@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "debug.hpp"
+#include "vm.hpp"
+
+// Runs every script given on the command line with opcode profiling enabled and prints the most frequent
+// opcode pairs and triples across the whole corpus. Sequences near the top are superinstruction candidates.
+//
+// With -R the scripts run as register code instead, and only the total instruction count is meaningful.
+//
+// Usage: LoxppOpcodeStats [-O<level>] [-R] [-n<count>] script.lox...
+
+using Counts = std::unordered_map<uint32_t, uint64_t>;
+
+static void merge(Counts& total, const Counts& counts)
+{
+    for (const auto& [key, count] : counts)
+    {
+        total[key] += count;
+    }
+}
+
+static void printTop(const std::string& title, const Counts& counts, int width, size_t limit)
+{
+    std::vector<std::pair<uint32_t, uint64_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    uint64_t total = 0;
+    for (const auto& entry : sorted)
+    {
+        total += entry.second;
+    }
+
+    std::cout << "== " << title << " (" << total << " total) ==" << std::endl;
+    for (size_t i = 0; i < sorted.size() && i < limit; i++)
+    {
+        const auto& [key, count] = sorted[i];
+        std::cout << count << "\t" << (100.0 * static_cast<double>(count) / static_cast<double>(total)) << "%\t";
+        for (int j = width - 1; j >= 0; j--)
+        {
+            std::cout << opcodeName(static_cast<uint8_t>(key >> (8 * j))) << (j > 0 ? " " : "");
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int optimizationLevel = 0;
+    size_t limit = 20;
+    bool registerMode = false;
+    uint64_t instructions = 0;
+    Counts bigrams;
+    Counts trigrams;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (std::strncmp(argv[arg], "-O", 2) == 0)
+        {
+            optimizationLevel = std::atoi(argv[arg] + 2);
+            continue;
+        }
+        if (std::strcmp(argv[arg], "-R") == 0)
+        {
+            registerMode = true;
+            continue;
+        }
+        if (std::strncmp(argv[arg], "-n", 2) == 0)
+        {
+            limit = static_cast<size_t>(std::atoi(argv[arg] + 2));
+            continue;
+        }
+
+        std::ifstream file(argv[arg]);
+        if (!file)
+        {
+            std::cerr << "Could not open file \"" << argv[arg] << "\"." << std::endl;
+            return 74;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+
+        // scripts print through std::cout; keep their output out of the report
+        std::stringstream discarded;
+        std::streambuf* output = std::cout.rdbuf(discarded.rdbuf());
+
+        VM vm;
+        vm.setOptimizationLevel(optimizationLevel);
+        vm.setRegisterMode(registerMode);
+        InterpretResult result = vm.interpret(buffer.str());
+
+        std::cout.rdbuf(output);
+        if (result != INTERPRET_OK)
+        {
+            std::cerr << argv[arg] << ": script failed, counts up to the error are kept" << std::endl;
+        }
+        if (registerMode && !vm.ranRegisterCode())
+        {
+            std::cerr << argv[arg] << ": not lowered to registers, its stack instructions are counted instead"
+                      << std::endl;
+        }
+
+        instructions += vm.opcodeProfile().instructions;
+        merge(bigrams, vm.opcodeProfile().bigrams);
+        merge(trigrams, vm.opcodeProfile().trigrams);
+    }
+
+    std::cout << "instructions executed: " << instructions << std::endl;
+    printTop("bigrams", bigrams, 2, limit);
+    printTop("trigrams", trigrams, 3, limit);
+
+    return 0;
+}
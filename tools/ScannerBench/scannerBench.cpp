@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "scanner.hpp"
+
+// Measures scanner throughput in MB/s: each source is scanned to TOKEN_EOF several times and the best run is
+// reported. Without script arguments it scans synthetic sources of the given size (16 MB by default), each
+// stressing one of the scanner's runs: whitespace and comments, identifiers and numbers, plus a mix of all.
+//
+// Compare LoxppScannerBench against LoxppScannerBenchScalar, which is built with -DSCALAR_SCANNER.
+//
+// Usage: LoxppScannerBench [-s<megabytes>] [-r<runs>] [script.lox...]
+
+static std::string repeatTo(const std::string& text, size_t size)
+{
+    std::string source;
+    source.reserve(size + text.size());
+    while (source.size() < size)
+    {
+        source += text;
+    }
+    return source;
+}
+
+static std::vector<std::pair<std::string, std::string>> syntheticSources(size_t size)
+{
+    const std::string mixed = "fun fibonacci(n) {\n"
+                              "    // the two previous terms, unless n is small enough to be its own answer\n"
+                              "    if (n < 2) return n;\n"
+                              "    return fibonacci(n - 1) + fibonacci(n - 2);\n"
+                              "}\n"
+                              "\n"
+                              "var greeting = \"hello\" + \" \" + \"world\";\n"
+                              "print fibonacci(20) * 3.25 >= total_so_far;\n";
+    const std::string comments = "        // a comment line that runs on for a while, as documentation tends to\n"
+                                 "\n"
+                                 "                \t\t  \n"
+                                 "        x = y;\n";
+    const std::string identifiers = "var an_identifier_of_some_length = another_identifier_of_similar_length;\n"
+                                    "shortName = yetAnotherQuiteDescriptiveName_2;\n";
+    const std::string numbers = "print 1234567890.0987654321 + 31415926535897 - 27182818284.5904;\n";
+
+    return {
+        {"mixed", repeatTo(mixed, size)},
+        {"comments", repeatTo(comments, size)},
+        {"identifiers", repeatTo(identifiers, size)},
+        {"numbers", repeatTo(numbers, size)},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = 16 * 1024 * 1024;
+    int runs = 5;
+    std::vector<std::pair<std::string, std::string>> sources;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (std::strncmp(argv[arg], "-s", 2) == 0)
+        {
+            size = static_cast<size_t>(std::atoi(argv[arg] + 2)) * 1024 * 1024;
+            continue;
+        }
+        if (std::strncmp(argv[arg], "-r", 2) == 0)
+        {
+            runs = std::max(1, std::atoi(argv[arg] + 2));
+            continue;
+        }
+
+        std::ifstream file(argv[arg], std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Could not open file \"" << argv[arg] << "\"." << std::endl;
+            return 74;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        sources.emplace_back(argv[arg], buffer.str());
+    }
+
+    if (sources.empty())
+    {
+        sources = syntheticSources(size);
+    }
+
+#ifdef SIMD_SCANNER
+    std::cout << "== SIMD scanner ==" << std::endl;
+#else
+    std::cout << "== scalar scanner ==" << std::endl;
+#endif
+
+    for (const auto& [name, source] : sources)
+    {
+        double best = 0.0;
+        size_t tokens = 0;
+        int lines = 0;
+        for (int run = 0; run < runs; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            Scanner scanner(source);
+            tokens = 0;
+            Token token;
+            do
+            {
+                token = scanner.scanToken();
+                tokens++;
+            } while (token.type != TOKEN_EOF);
+            lines = token.line;
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            double throughput = static_cast<double>(source.size()) / (1024.0 * 1024.0) / elapsed.count();
+            best = std::max(best, throughput);
+        }
+
+        std::cout << name << "\t" << source.size() / (1024 * 1024) << " MB\t" << tokens << " tokens\t" << lines
+                  << " lines\t" << best << " MB/s" << std::endl;
+    }
+
+    return 0;
+}